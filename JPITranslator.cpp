@@ -1,22 +1,54 @@
 #define _CRT_SECURE_NO_WARNINGS
 
-#include <tchar.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdarg.h>
-#include <minmax.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <chrono>
+
 #include <cstring>
 #include <assert.h>
 #include <errno.h>
-#include <io.h>
 #include <fcntl.h>
 #include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "jpi.h"
+#include "jpiformat.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <minmax.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <limits.h>
+#include <glob.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#endif
+
 #ifdef _DEBUG
 // The .DAT file format debugging features are a bit
 // confusing for the average non-programmer user, so 
@@ -25,83 +57,180 @@
 #endif
 
 
-
-
+#ifndef _WIN32
 //
-// Some general helper definitions and functions
+// Built with something other than the Microsoft C runtime, these are the
+// bits of it that are used here
 //
 
+#define _stat stat
+#define _fstat fstat
+#define _fileno fileno
+
+#define _O_BINARY 0
+#define _O_TEXT 0
+#define _O_RDONLY O_RDONLY
+#define _O_WRONLY O_WRONLY
+#define _O_CREAT O_CREAT
+#define _O_TRUNC O_TRUNC
+#define _S_IREAD 0444
+#define _S_IWRITE 0666
+#define _S_IFMT S_IFMT
+#define _S_IFREG S_IFREG
+
+#define _MAX_PATH PATH_MAX
+#define _MAX_DRIVE 1
+#define _MAX_DIR PATH_MAX
+#define _MAX_FNAME (NAME_MAX + 1)
+#define _MAX_EXT (NAME_MAX + 1)
+
+#ifndef max
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#endif
 
+// (not #defines, as outwriter has members called open, close and write)
+static inline int _open(const char* path, int oflag, int pmode = 0)
+{
+	return open(path, oflag, pmode);
+}
 
-typedef unsigned char byte;
-typedef unsigned short ushort;
-typedef unsigned long ulong;
-
-#define countof(array) (sizeof(array)/sizeof(array[0]))
-
-
-// Fatal error - give message and exit
-static void errexit(const char* msg, ...)
+static inline int _close(int fd)
 {
-	assert(msg != NULL);
-	va_list args;
-	va_start(args, msg);
-	vprintf(msg, args);
-	exit(1);
+	return close(fd);
 }
 
-// Helpers to swap byte order for big endian
-static inline ushort byteswap(ushort w) {
-	return (((w & 0xFF00) >> 8) |
-		((w & 0x00FF) << 8));
+static inline int _read(int fd, void* buf, unsigned n)
+{
+	return (int)read(fd, buf, n);
 }
 
-static inline ulong byteswap(ulong dw) {
-	return (((dw & 0xFF000000) >> 24) |
-		((dw & 0x00FF0000) >> 8) |
-		((dw & 0x0000FF00) << 8) |
-		((dw & 0x000000FF) << 24));
+static inline int _write(int fd, const void* buf, unsigned n)
+{
+	return (int)write(fd, buf, n);
 }
 
-// Generic bit vector manipulations
-static bool testbit(const void* pv, unsigned bitoffset)
+static inline long _lseek(int fd, long offset, int origin)
 {
-	assert(pv != NULL);
-	assert(0 <= bitoffset && bitoffset < 128); // arbitrary limit for argument sanity checking
-	return ((((byte*)pv)[bitoffset / 8] & (1 << (bitoffset % 8))) != 0);
+	return (long)lseek(fd, offset, origin);
 }
 
-static void setbit(void* pv, unsigned bitoffset)
+// There's no text mode to get out of
+static inline int _setmode(int, int)
 {
-	assert(pv != NULL);
-	assert(0 <= bitoffset && bitoffset < 128); // arbitrary limit for argument sanity checking
-	((byte*)pv)[bitoffset / 8] |= (byte)(1 << (bitoffset % 8));
+	return 0;
 }
 
-static void clearbit(void* pv, unsigned bitoffset)
+// There are no drive letters, so drive is always empty
+static void _splitpath(const char* path, char* drive, char* dir, char* fname, char* ext)
 {
-	assert(pv != NULL);
-	assert(0 <= bitoffset && bitoffset < 128); // arbitrary limit for argument sanity checking
-	((byte*)pv)[bitoffset / 8] &= ~(byte)(1 << (bitoffset % 8));
+	const char* slash = strrchr(path, '/');
+	const char* base = slash ? slash + 1 : path;
+	const char* dot = strrchr(base, '.');
+	if (dot == NULL || dot == base)
+		dot = base + strlen(base);
+	if (drive)
+		*drive = 0;
+	if (dir) {
+		memcpy(dir, path, base - path);
+		dir[base - path] = 0;
+	}
+	if (fname) {
+		memcpy(fname, base, dot - base);
+		fname[dot - base] = 0;
+	}
+	if (ext)
+		strcpy(ext, dot);
 }
 
-// Utility class to save a value and a pointer to it and later restore the value
-template <class T> class pushpop {
-	T savedval;
-	T* savedptr;
-	pushpop();											// prohibit
-	pushpop(const pushpop& p);						// prohibit
-	pushpop& operator=(const pushpop& p);		// prohibit
-public:
-	pushpop(T* ptr, T val) : savedval(*ptr), savedptr(ptr) {
-		assert(ptr != NULL);
-		*ptr = val;
+static void _makepath(char* path, const char* drive, const char* dir, const char* fname, const char* ext)
+{
+	*path = 0;
+	if (dir && *dir) {
+		strcat(path, dir);
+		if (path[strlen(path) - 1] != '/')
+			strcat(path, "/");
 	}
-	~pushpop(void) {
-		*savedptr = savedval;
+	if (fname)
+		strcat(path, fname);
+	if (ext && *ext) {
+		if (*ext != '.')
+			strcat(path, ".");
+		strcat(path, ext);
 	}
+}
+
+// The wildcard search, with glob()
+struct _finddata_t {
+	char name[_MAX_FNAME];
+};
+
+struct findstate {
+	glob_t g;
+	size_t i;
 };
 
+static void findname(const findstate* pFind, _finddata_t* fdata)
+{
+	const char* path = pFind->g.gl_pathv[pFind->i];
+	const char* slash = strrchr(path, '/');
+	snprintf(fdata->name, sizeof(fdata->name), "%s", slash ? slash + 1 : path);
+}
+
+static intptr_t _findfirst(const char* spec, _finddata_t* fdata)
+{
+	findstate* pFind = new findstate;
+	if (glob(spec, 0, NULL, &pFind->g) != 0) {
+		delete pFind;
+		return -1;
+	}
+	pFind->i = 0;
+	findname(pFind, fdata);
+	return (intptr_t)pFind;
+}
+
+static int _findnext(intptr_t hf, _finddata_t* fdata)
+{
+	findstate* pFind = (findstate*)hf;
+	if (++pFind->i >= pFind->g.gl_pathc)
+		return -1;
+	findname(pFind, fdata);
+	return 0;
+}
+
+static int _findclose(intptr_t hf)
+{
+	findstate* pFind = (findstate*)hf;
+	globfree(&pFind->g);
+	delete pFind;
+	return 0;
+}
+#endif // !_WIN32
+
+
+
+
+//
+// Some general helper definitions and functions
+//
+
+
+
+#define countof(array) (sizeof(array)/sizeof(array[0]))
+
+
+// Fatal error - give message and exit
+static void errexit(const char* msg, ...)
+{
+	assert(msg != NULL);
+	va_list args;
+	va_start(args, msg);
+	vprintf(msg, args);
+	exit(1);
+}
+
 
 
 //
@@ -126,7 +255,7 @@ char** getfilelist(const char* fnam)
 	if ((hf = _findfirst(fnam, &fdata)) == -1)
 		errexit("Unable to find file %s", fnam);
 	do {
-		if (n >= nalloc) {
+		if (n + 1 >= nalloc) {							// leave room for the NULL terminator
 			nalloc = max(8, nalloc * 2);
 			retval = (char**)realloc(retval, sizeof(char*) * nalloc);
 		}
@@ -151,593 +280,1758 @@ static void freelist(char** list)
 
 
 
+//
+// A small pool of worker threads for batch conversion. Tasks are run in
+// the order queued, and a thread waiting on a group of tasks helps run
+// queued tasks instead of sitting idle. With no worker threads started,
+// tasks simply run as they're queued.
+//
+
+struct taskgroup {
+	std::atomic<unsigned> nPending;
+	taskgroup() : nPending(0) {}
+};
 
+class taskpool {
+	struct task {
+		std::function<void()> fn;
+		taskgroup* group;
+	};
+	std::vector<std::thread> threads;
+	std::deque<task> tasks;
+	std::mutex lock;
+	std::condition_variable wake;					// signaled for new tasks and finished tasks
+	bool bQuit;
+
+	void runtask(std::unique_lock<std::mutex>& held) {
+		task t = tasks.front();
+		tasks.pop_front();
+		held.unlock();
+		t.fn();
+		held.lock();
+		t.group->nPending--;
+		wake.notify_all();
+	}
 
+	void worker(void) {
+		std::unique_lock<std::mutex> held(lock);
+		for (;;) {
+			while (!bQuit && tasks.empty())
+				wake.wait(held);
+			if (tasks.empty())
+				return;
+			runtask(held);
+		}
+	}
 
+public:
+	taskpool() : bQuit(false) {}
+	~taskpool() { stop(); }
+
+	// nThreads counts the calling thread, which works while it waits
+	void start(unsigned nThreads) {
+		assert(threads.empty());
+		while (nThreads-- > 1)
+			threads.push_back(std::thread(&taskpool::worker, this));
+	}
 
-//
-// Program argument flags
-//
+	void stop(void) {
+		{
+			std::lock_guard<std::mutex> held(lock);
+			bQuit = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+		threads.clear();
+	}
 
-#ifdef DBGOPTS // This stuff only useful for debugging
-static bool s_bDisplayHeaders = false;			// -h
-static bool s_bDebugDetail = false;				// -d
-static bool s_bCompareCSV = false;					// -c
-static bool noflights = false;						// -n
-#endif // DBGOPTS
+	void run(taskgroup& group, const std::function<void()>& fn) {
+		if (threads.empty()) {
+			fn();
+			return;
+		}
+		std::lock_guard<std::mutex> held(lock);
+		group.nPending++;
+		task t = { fn, &group };
+		tasks.push_back(t);
+		wake.notify_one();
+	}
 
-static ushort s_nOnlyFlight = 0;					// -f
-static bool s_bSuppressSuffix = false;			// -s
-static bool s_bRecalcChecksums = false;   		// -r
-
-// Set these when we determine which firmware version would apply
-static ushort s_NewVersion;                     // firmware version that signifies new checksum
-static const char* s_szOldVer;
-
-static const struct {
-	ushort model;
-	ushort newversion;
-	const char* oldverstring;
-} newmodeltable[] = {
-	{760,140,"139"}, // EDM-760 has different versioning stream, correct "new" version is a guess
-	{0,300,"299"} // all other models what is known at this point
+	void wait(taskgroup& group) {
+		std::unique_lock<std::mutex> held(lock);
+		while (group.nPending > 0) {
+			if (!tasks.empty())
+				runtask(held);
+			else
+				wake.wait(held);
+		}
+	}
 };
 
+static taskpool s_pool;
+
+
+
+
+
+
 
 //
-// File handling - just read the whole darn .DAT file into memory
+// Buffered output for the CSV files. Lines are collected in a big buffer, and
+// when it fills up it's handed to a background thread to write while the other
+// buffer fills, so decoding doesn't wait on the disk (or a slow network share).
+// A file that fits in one buffer is just written when it's closed, without
+// starting a thread. A failed write is remembered and shows up in error()
+// rather than stopping anything part way through a line.
 //
 
-static byte* s_pFileBytes;							// =NULL
-static size_t s_nAlloc;
-static size_t s_nFileBytes;
-static char s_szCurrFile[_MAX_PATH];
+static const size_t OUTBUF_SIZE = 256 * 1024;
+
+class outwriter {
+	int fd;
+	char* buf[2];
+	unsigned iFill;									// buffer being filled, the other one is the writer's
+	size_t nFill;										// bytes in buf[iFill]
+	size_t nToWrite;									// bytes in the other buffer not written yet
+	long nFileOffset;									// where buf[iFill] goes in the file
+	bool bText;
+	std::atomic<int> nErr;							// errno of the first failed write
+	std::thread writer;
+	std::mutex lock;
+	std::condition_variable wake;
+	bool bQuit;
+
+	void writeloop(void);
+	void writeall(const char* p, size_t n);
+	void handoff(void);
+	long filebytes(const char* p, size_t n) const;
+
+public:
+	outwriter() : fd(-1), iFill(0), nFill(0), nToWrite(0), nFileOffset(0), bText(false), nErr(0), bQuit(false) { buf[0] = buf[1] = NULL; }
+	~outwriter() { close(); }
+
+	bool open(const char* path, bool bText = true);
+	bool isopen(void) const { return fd != -1; }
+	int error(void) const { return nErr; }
+
+	void write(const char* p, size_t n) {
+		while (n > OUTBUF_SIZE - nFill) {
+			size_t nPart = OUTBUF_SIZE - nFill;
+			memcpy(buf[iFill] + nFill, p, nPart);
+			nFill += nPart;
+			p += nPart;
+			n -= nPart;
+			handoff();
+		}
+		memcpy(buf[iFill] + nFill, p, n);
+		nFill += n;
+	}
+
+	void flush(void);
+	long tell(void) const { return nFileOffset + filebytes(buf[iFill], nFill); }
+	void patch(long offset, const char* p, size_t n);
+	int close(void);
+};
 
-static void read_file(const char* szFilename)
+bool outwriter::open(const char* path, bool bText)
 {
-	assert(szFilename != NULL && strlen(szFilename));
-	strcpy(s_szCurrFile, szFilename);
-	int fd = _open(szFilename, _O_BINARY | _O_RDONLY);
-	if (fd == -1)
-		errexit("Unable to open file %s\n%s", szFilename, strerror(errno));
-	struct _stat filestats;
-	if (_fstat(fd, &filestats) < 0)
-		errexit("Unable to get file size %s", szFilename);
-	if (s_nAlloc < (size_t)filestats.st_size) {
-		if (!(s_pFileBytes = (byte*)realloc(s_pFileBytes, filestats.st_size)))
-			errexit("Memory allocation failed (%d bytes)", filestats.st_size);
-		s_nAlloc = filestats.st_size;
-	}
-	if ((s_nFileBytes = _read(fd, s_pFileBytes, filestats.st_size)) <= 0)
-		errexit("Error reading file %s\n%s", szFilename, strerror(errno));
-	_close(fd);
+	assert(!isopen());
+	if (!(buf[0] = (char*)malloc(OUTBUF_SIZE)) || !(buf[1] = (char*)malloc(OUTBUF_SIZE))) {
+		free(buf[0]);
+		buf[0] = NULL;
+		errno = ENOMEM;
+		return false;
+	}
+	// text mode is the same as fopen(path, "w")
+	fd = _open(path, (bText ? _O_TEXT : _O_BINARY) | _O_CREAT | _O_WRONLY | _O_TRUNC, _S_IWRITE);
+	if (!isopen()) {
+		int nOpenErr = errno;
+		free(buf[0]);
+		free(buf[1]);
+		buf[0] = buf[1] = NULL;
+		errno = nOpenErr;
+		return false;
+	}
+	this->bText = bText;
+	nFileOffset = 0;
+	return true;
 }
 
-static void setdir(const char* basenam, char* outname, size_t outsize)
+// How many bytes p to p + n take up in the file, as text mode on Windows
+// writes each LF as CR LF
+long outwriter::filebytes(const char* p, size_t n) const
 {
-	assert(basenam != NULL && outname != NULL && outsize >= _MAX_PATH);
-	char drive[_MAX_DRIVE];
-	char dir[_MAX_DIR];
-	char name[_MAX_FNAME];
-	char ext[_MAX_EXT];
-
-	_splitpath(s_szCurrFile, drive, dir, NULL, NULL);
-	_splitpath(basenam, NULL, NULL, name, ext);
-	_makepath(outname, drive, dir, name, ext);
+	long nBytes = (long)n;
+#ifdef _WIN32
+	if (bText) {
+		const char* pEnd = p + n;
+		while ((p = (const char*)memchr(p, '\n', pEnd - p)) != NULL) {
+			nBytes++;
+			p++;
+		}
+	}
+#endif
+	return nBytes;
 }
 
-static void write_file(const char* szFilename, const void* bytes, size_t nbytes)
+// Write out everything written so far
+void outwriter::flush(void)
 {
-	assert(szFilename != NULL && strlen(szFilename));
-	assert(bytes != NULL && nbytes > 0);
-	int fd = _open(szFilename, _O_BINARY | _O_CREAT | _O_WRONLY | _O_TRUNC, _S_IWRITE);
-	if (fd == -1)
-		errexit("Unable to open output file %s\n%s", szFilename, strerror(errno));
-	if (_write(fd, bytes, (unsigned)nbytes) != nbytes)
-		errexit("Error writing file %s\n%s", szFilename, strerror(errno));
-	_close(fd);
+	if (writer.joinable()) {
+		if (nFill)
+			handoff();
+		std::unique_lock<std::mutex> held(lock);
+		while (nToWrite)
+			wake.wait(held);
+	}
+	else if (nFill) {
+		writeall(buf[iFill], nFill);
+		nFileOffset += filebytes(buf[iFill], nFill);
+		nFill = 0;
+	}
 }
 
-static void write_renamed_file(const char* szSuffix, const char* szExt)
+// Overwrite some of what's been written already
+void outwriter::patch(long offset, const char* p, size_t n)
 {
-	char drive[_MAX_DRIVE];
-	char dir[_MAX_DIR];
-	char name[_MAX_FNAME];
-	char ext[_MAX_EXT];
-	char newpath[_MAX_PATH];
-	_splitpath(s_szCurrFile, drive, dir, name, ext);
-	strcat(name, szSuffix);
-	if (szExt == NULL)
-		szExt = ext;
-	_makepath(newpath, drive, dir, name, szExt);
-	write_file(newpath, s_pFileBytes, s_nFileBytes);
+	flush();
+	if (_lseek(fd, offset, SEEK_SET) == offset)
+		writeall(p, n);
+	_lseek(fd, 0, SEEK_END);
 }
 
+// Returns 0 or the errno of a write that failed
+int outwriter::close(void)
+{
+	if (!isopen())
+		return 0;
+	flush();
+	if (writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> held(lock);
+			bQuit = true;
+		}
+		wake.notify_all();
+		writer.join();
+	}
+	if (_close(fd) != 0 && !nErr)
+		nErr = errno;
+	fd = -1;
+	free(buf[0]);
+	free(buf[1]);
+	buf[0] = buf[1] = NULL;
+	nFill = 0;
+	bQuit = false;
+	return nErr;
+}
 
-//
-// Data definitions for various records used
-//
+// Give the full buffer to the writer thread once it's done with the other one
+void outwriter::handoff(void)
+{
+	if (!writer.joinable())
+		writer = std::thread(&outwriter::writeloop, this);
+	std::unique_lock<std::mutex> held(lock);
+	while (nToWrite)
+		wake.wait(held);
+	nFileOffset += filebytes(buf[iFill], nFill);
+	nToWrite = nFill;
+	iFill ^= 1;
+	nFill = 0;
+	wake.notify_all();
+}
 
-#pragma pack(push)
-#pragma pack(1)
-
-
-// $U record
-static char tailnum[16];							// should be enough space
-
-// $A record
-static struct {
-	ushort voltshi;
-	ushort voltslo;
-	ushort dif;
-	ushort cht;
-	ushort cld;
-	ushort tit;
-	ushort oilhi;
-	ushort oillo;
-} limits;
-
-// $C record
-static struct {
-	ushort model;
-	ulong  flags;										// configuration bit flags
-	ushort unknown_value;							// maybe more bit flags?
-	ushort firmware_version;						// n.nn * 100
-} config;
-
-//Decoding of the configuration bit flagss:
-//-m-d fpai r2to eeee eeee eccc cccc cc-b
-//
-// e = egt (up to 9 cyls)
-// c = cht (up to 9 cyls)
-// d = probably cld
-// b = bat
-// o = oil
-// t = tit1
-// 2 = tit2
-// a = OAT
-// f = fuel flow
-// r = CDT (also CARB - apparently it's not distinguished in the CSV output)
-// i = IAT
-// m = MAP
-// p = RPM
-// *** e and c may be swapped
-// *** d and b may be swapped (but seem to always occur anyway)
-// *** m, p and i may be swapped among themselves
-
-static const int MAX_CYLS = 9;					  // up to 9 cyls possible
-
-static inline unsigned NUMCYLS(ulong flg = config.flags) {
-	ulong mask = 0x00000004;
-	unsigned n = 0;
-	while (n < MAX_CYLS && (flg & mask)) {
-		n++;
-		mask <<= 1;
-	}
-	return n;
-}
-static inline unsigned NUMENGINE() {
-	return (config.model == 760) ? 2 : 1;
-}
-static const ulong F_BAT = 0x00000001;
-static const ulong F_C1 = 0x00000004;
-static const ulong F_C2 = 0x00000008;
-static const ulong F_C3 = 0x00000010;
-static const ulong F_C4 = 0x00000020;
-static const ulong F_C5 = 0x00000040;
-static const ulong F_C6 = 0x00000080;
-static const ulong F_C7 = 0x00000100;
-static const ulong F_C8 = 0x00000200;
-static const ulong F_C9 = 0x00000400;
-static const ulong F_E1 = 0x00000800;
-static const ulong F_E2 = 0x00001000;
-static const ulong F_E3 = 0x00002000;
-static const ulong F_E4 = 0x00004000;
-static const ulong F_E5 = 0x00008000;
-static const ulong F_E6 = 0x00010000;
-static const ulong F_E7 = 0x00020000;
-static const ulong F_E8 = 0x00040000;
-static const ulong F_E9 = 0x00080000;
-static const ulong F_OIL = 0x00100000;
-static const ulong F_T1 = 0x00200000;
-static const ulong F_T2 = 0x00400000;
-static const ulong F_CDT = 0x00800000;			// also CRB
-static const ulong F_IAT = 0x01000000;
-static const ulong F_OAT = 0x02000000;
-static const ulong F_RPM = 0x04000000;
-static const ulong F_FF = 0x08000000;
-static const ulong F_USD = F_FF;					// duplicate
-static const ulong F_CLD = 0x10000000;			// Uh - I think.
-static const ulong F_MAP = 0x40000000;
-static const ulong F_DIF = F_E1 | F_E2;			// DIF exists if there's more than one EGT
-static const ulong F_HP = F_RPM | F_MAP | F_FF;
-static const ulong F_MARK = 0x00000001;			// 1 bit always seems to exist
-
-// quick way to define a bunch of funcs...
-#define HAS(what) static inline bool HAS##what(ulong flg=config.flags) {return ((flg & F_##what) == F_##what);}
-HAS(RPM)
-HAS(FF)
-HAS(HP)
-
-// $F record
-static struct {
-	ushort warn1;
-	ushort capacity;
-	ushort warn2;
-	ushort kf1;
-	ushort kf2;
-} fuel;
-
-// $T record
-static struct {
-	ushort mon;
-	ushort day;
-	ushort yr;
-	ushort hh;
-	ushort mm;
-	ushort unknown_value;
-} timestamp;
-
-// $L record
-static ushort headerend;
-
-// $D record
-struct flight {
-	ushort flightnum;
-	ushort data_length; // data length is expressed as # of 16 bit words
-};
+void outwriter::writeloop(void)
+{
+	std::unique_lock<std::mutex> held(lock);
+	for (;;) {
+		while (!nToWrite && !bQuit)
+			wake.wait(held);
+		if (!nToWrite)
+			return;
+		const char* p = buf[iFill ^ 1];
+		size_t n = nToWrite;
+		held.unlock();
+		writeall(p, n);
+		held.lock();
+		nToWrite = 0;
+		wake.notify_all();
+	}
+}
 
+void outwriter::writeall(const char* p, size_t n)
+{
+	while (n > 0 && !nErr) {
+		int nwritten = _write(fd, p, (unsigned)n);
+		if (nwritten <= 0)
+			nErr = (nwritten < 0 && errno) ? errno : EIO;
+		else {
+			p += nwritten;
+			n -= nwritten;
+		}
+	}
+}
 
-// First record in each flight's data stream
-struct flightheader {
-	ushort flightnum;
-	ulong flags;
-	ushort unknown_value;							// Don't know this one yet
-	ushort interval_secs;							// Hmmm... have seen some counter-examples!?
-	ushort dt;											// see decode_datebits
-	ushort tm;											// see decode_timebits
-};
 
 
-// Each record of data stream
-union datarec {
-	short sarray[1];									// syntactical shorthand
-	struct {
-		// first byte of val/sign/scale flags
-		short egt[6];
-		short t1;
-		short t2;
-
-		// second byte of val/sign(/scale?) flags
-		short cht[6];
-		short cld;
-		short oil;
-
-		// third byte of val/sign(/scale?) flags
-		short mark;
-		short unk_3_1;
-		short cdt;
-		short iat;
-		short bat;
-		short oat;
-		short usd;
-		short ff;
-
-		// fourth byte of val/sign(/scale?) flags
-		short regt[6];									// NOTE: in 7/8/9 cyl case, E7-9 and C7-9 are stored here too
-		union {
-			short hp;									// single engine EDM-800
-			short rt1;									// twin engine EDM-760
-		};
-		short rt2;
-
-		// fifth byte of val/sign(/scale?) flags
-		short rcht[6];
-		short rcld;
-		short roil;
-
-		// sixth byte of val/sign(/scale?) flags
-		short map;										// single engine EDM-800
-		short rpm;										// single engine EDM-800
-		union {
-			short rpm_highbyte;						// single engine EDM-800
-			short rcdt;									// twin engine EDM-760
-		};
-		short riat;
-		short unk_6_4;
-		short unk_6_5;
-		short rusd;
-		short rff;
-
-		short dif[2];									// HACK - this gets computed
-		byte naflags[6];
-	};
 
-	datarec(void) {
-		for (int i = 0; i < sizeof(*this) / sizeof(ushort); i++)
-			sarray[i] = 0x00f0;
-		if (NUMENGINE() == 1) {
-			// seen only one example of this... unclear why it's an exception to
-			// the 0xf0 initializations.
-			hp = 0;
-			rpm_highbyte = 0;							// really a "scale" byte
-		}
+//
+// Program argument flags
+//
 
-		dif[0] = dif[1] = 0;
-		memset(naflags, 0, sizeof(naflags));
-	}
+struct whereexpr;
 
-	void calcstuff(ulong configflags);
+// Switches only apply to files that follow them on the cmd line, so each
+// file gets its own copy of these as they stand when the file is named.
+struct options {
+#ifdef DBGOPTS // This stuff only useful for debugging
+	bool bDisplayHeaders;							// -h
+	bool bDebugDetail;								// -d
+	bool bCompareCSV;									// -c
+	bool bNoFlights;									// -n
+#endif // DBGOPTS
 
+	ushort nOnlyFlight;								// -f
+	bool bSuppressSuffix;							// -s
+	bool bRecalcChecksums;							// -r
+	bool bUTC;											// -u
+	bool bArrow;										// --format arrow
+	bool bCatalog;										// --catalog
+	bool bStats;										// --stats
+	bool bStatsJson;									// --stats=json
+	bool bSummary;										// --summary
+	bool bExceedances;								// --exceedances
+	bool bColumns;										// --columns...
+	uint64_t columnmask[2];							// ...the fielddesc[] entries wanted for the L (or only) and R engines
+	std::shared_ptr<const whereexpr> pWhere;	// --where
+	bool bWindow;										// -t
+	ulong nFromSecs, nToSecs;						// -t, from the start of the flight
 };
 
-static const unsigned TWINJUMP = offsetof(datarec, regt) / sizeof(short); // offset of 2nd engine egt fields
+static options s_opts;								// =all off
+static unsigned s_nJobs = 1;						// -j
 
 
-// DIF is calculated
-void datarec::calcstuff(ulong configflags)
-{
-	int nCyls = NUMCYLS(configflags);
+// The $A limits that --summary counts the time over, and the columns held to each
+enum { LIMIT_CHT, LIMIT_DIF, LIMIT_TIT, LIMIT_OIL, NUM_LIMITS };
+static const ushort NO_LIMIT = 0xffff;
+static const char* const s_limitnames[NUM_LIMITS] = { "CHT", "DIF", "TIT", "OIL" };
 
-	// max twin engine is 6 cyls per engine
-	assert(nCyls <= 6 || NUMENGINE() == 1);
+static ushort limitof(const char* szName)
+{
+	if (szName[0] == 'C' && isdigit((byte)szName[1]))
+		return LIMIT_CHT;
+	if (szName[0] == 'T' && isdigit((byte)szName[1]))
+		return LIMIT_TIT;
+	if (strcmp(szName, "DIF") == 0)
+		return LIMIT_DIF;
+	if (strcmp(szName, "OIL") == 0)
+		return LIMIT_OIL;
+	return NO_LIMIT;
+}
 
-	for (unsigned j = 0; j < NUMENGINE(); j++) {
-		short emax = -1, emin = 0x7fff;
-		for (int i = 0; i < nCyls; i++) {
-			// cyls 7,8 & 9 are stored in the regt field, so this hack lines 'em up
-			int idx = (i < 6) ? (i + j * TWINJUMP) : (i - 6 + TWINJUMP);
-			if (!testbit(naflags, idx)) {
-				if (egt[idx] < emin) emin = egt[idx];
-				if (egt[idx] > emax) emax = egt[idx];
-			}
-		}
-		dif[j] = emax - emin;
+// 0 when the instrument has no limit set
+static ushort limitvalue(const limitsrec& limits, ushort nLimit)
+{
+	switch (nLimit) {
+	case LIMIT_CHT: return limits.cht;
+	case LIMIT_DIF: return limits.dif;
+	case LIMIT_TIT: return limits.tit;
+	case LIMIT_OIL: return limits.oilhi;
 	}
+	return 0;
+}
 
-	if (HASRPM(configflags)) {
-		rpm += (rpm_highbyte << 8);
-		rpm_highbyte = 0;							// ??
+//
+// --summary gives each flight a line of a summary file instead of a CSV file:
+// the least, most and mean of each column, the fuel burned, and the time
+// spent over the $A limits. It's all added up as the rows are decoded, and a
+// data record's values are only gone through once however many rows repeat
+// them, since they're kept and the rows just counted until the next record
+// comes along (see flightctx::addsummary()).
+//
+struct flightsummary {
+	struct range {
+		short nMin, nMax;
+		int64_t nSum;										// of every row's value
+		ulong nRows;										// rows it wasn't NA in
+	};
+	range ranges[MAX_COLUMNS];						// for flightctx::columns
+	ushort nLimits[MAX_COLUMNS];					// the $A limit each is held to, or NO_LIMIT
+	bool bInFlight[MAX_COLUMNS];					// the flight has it, not just the $C record
+	ulong nOverRows[NUM_LIMITS];					// rows with a column over the limit
+	datarec last;										// values of the rows not added in yet...
+	ulong nLastRows;									// ...and how many rows there were
+
+	flightsummary() : last(1), nLastRows(0) {
+		memset(ranges, 0, sizeof(ranges));
+		memset(nOverRows, 0, sizeof(nOverRows));
 	}
-}
+};
 
+//
+// --exceedances lists the times each value went over (or under) its $A limit,
+// each as an event with when it started and ended and the worst value seen,
+// instead of writing a CSV file. Every column with a limit gets a
+// limitcheck, looked at as the rows are decoded. The CHTs are also checked
+// for cooling too fast, by how far each dropped over the last COOLING_SECS,
+// against the CLD limit (degrees a minute).
+//
+// Rows that -t or --where leave out aren't checked, so the rows checked can
+// have gaps. A gap ends any event going on at the last row checked before it,
+// and the cooling checks start over after it rather than compare CHTs from
+// either side of it.
+//
+static const unsigned COOLING_SECS = 60;
+static const unsigned MAX_COOLING = 2 * MAX_CYLS;	// CHTs of both engines
+static const short NA_VALUE = -32768;				// in limitcheck::recent
+
+struct limitcheck {
+	const char* szParam;								// "CHT", "OIL LO" and so on
+	ushort iColumn;									// in flightctx::columns
+	short nLimit;										// in the column's units (tenths for BAT)
+	bool bLow;											// under the limit is bad, rather than over
+	short* recent;										// for a cooling check, the CHTs of the last COOLING_SECS
+
+	// The event going on, if any
+	bool bActive;
+	time_t tFrom;
+	short nPeak;
+};
 
-// HACK ALERT - special case for the RPM value, which seems to have the "scale" 
-// in the next data field, so we need to recognize it and account for it because
-// they don't make the scale's sign bit match. See the special case lines in
-// parse_data() that take care of this.
-static const unsigned RPM_FIELD_NUM = offsetof(datarec, rpm) / sizeof(short);
-static const unsigned RPM_HIGHBYTE_FIELD_NUM = offsetof(datarec, rpm_highbyte) / sizeof(short);
+struct flightlimits {
+	limitcheck checks[2 * MAX_COLUMNS];
+	unsigned nChecks;
+	unsigned nCoolingRows;							// rows back to compare with for the cooling checks
+	ulong nRows;										// rows checked since the last gap
+	time_t tLast;										// time of the last row checked
+	std::string events;								// the lines of the ones that ended
+	short recent[MAX_COOLING][COOLING_SECS + 1];	// a ring of nCoolingRows + 1 CHTs each
 
+	flightlimits() : nChecks(0), nCoolingRows(1), nRows(0), tLast(0) {}
+};
 
 //
-// This table is a description of the fields in data records, with offsets and
-// text headers and the like. Be sure to KEEP THE FIELDS SORTED IN ORDER OF 
-// THE CSV FILE OUTPUT!!!
-
-// a shorthand macro to save typing in the table...
-#define FLG(name) #name,F_##name
-
-static struct {
-	bool bPerEngine;									// true if a val is per engine, false if just one val (EDM-760)
-	int nOffset;										// offset of field in rec.sarray
-	unsigned nScale;									// some are scaled by 10, most are not
-	const char* szName;								// title of field in CSV file
-	ulong nFeatureFlag;
-	unsigned nWhichEng;								// bit flags to flag which engine the item should display for
-} const fielddesc[] = {
-	{true , 0, 1,FLG(E1)},
-	{true , 1, 1,FLG(E2)},
-	{true , 2, 1,FLG(E3)},
-	{true , 3, 1,FLG(E4)},
-	{true , 4, 1,FLG(E5)},
-	{true , 5, 1,FLG(E6)},
-	{true , TWINJUMP + 0, 1,FLG(E7)},
-	{true , TWINJUMP + 1, 1,FLG(E8)},
-	{true , TWINJUMP + 2, 1,FLG(E9)},
-	{true , 8, 1,FLG(C1)},
-	{true , 9, 1,FLG(C2)},
-	{true ,10, 1,FLG(C3)},
-	{true ,11, 1,FLG(C4)},
-	{true ,12, 1,FLG(C5)},
-	{true ,13, 1,FLG(C6)},
-	{true , TWINJUMP + 3, 1,FLG(C7)},
-	{true , TWINJUMP + 4, 1,FLG(C8)},
-	{true , TWINJUMP + 5, 1,FLG(C9)},
-	{true , 6, 1,FLG(T1)},
-	{true , 7, 1,FLG(T2)},
-	{true ,15, 1,FLG(OIL)},
-	{true ,-1, 1,FLG(DIF)},
-	{true ,14, 1,FLG(CLD)},
-	{false,21, 1,FLG(OAT)},
-	{true ,18, 1,FLG(CDT)},			// not sure whether these are available in the twin model
-	{true ,19, 1,FLG(IAT)},
-	{false,20,10,FLG(BAT),0x01},	// battery comes before FF/USD in the single models...
-	{true ,23,10,FLG(FF)},
-	{true ,22,10,FLG(USD)},
-	{false,20,10,FLG(BAT),0x02},	// battery comes after FF/USD in the twin model... sigh
-	{false,41, 1,FLG(RPM)},			// these only are available in the single EDM models
-	{false,40,10,FLG(MAP)},
-	{false,30, 1,FLG(HP)},
-
-	{false,16, 1,FLG(MARK)}
+// --where only keeps the rows that match an expression like
+// "CHT>400 || DIF>150 || OIL<40". It's parsed once, from the command line,
+// into a whereexpr (see parsewhere()), and then compiled for each flight's
+// columns into a wherefilter: the comparisons, with each name turned into
+// where its value is, as a little postfix program run on rec. A comparison
+// with an NA value, or a column the flight doesn't have, is false, and a
+// name for more than one column (CHT, or E1 on a twin) is true if any of
+// them is.
+//
+enum whereop { WHERE_LT, WHERE_LE, WHERE_GT, WHERE_GE, WHERE_EQ, WHERE_NE, WHERE_AND, WHERE_OR, WHERE_NOT, WHERE_FALSE };
+
+struct wherenode {
+	whereop op;
+	unsigned a, b;										// operands of AND, OR and NOT, in whereexpr::nodes
+	std::string name;									// of a comparison...
+	double value;										// ...and what it's compared with
 };
 
-#pragma pack(pop)
+struct whereexpr {
+	std::vector<wherenode> nodes;
+	unsigned root;
+};
 
-static flight flightlist[512];					// hopefully enough capacity for any single .DAT file
-static unsigned s_nFlights;
+struct wherestep {
+	whereop op;
+	ushort nOffset;									// for a comparison, the value in rec.sarray...
+	ushort nNABit;										// ...its bit in rec.naflags, or NO_NABIT
+	int nValue;											// ...and what it's compared with, in the column's units
+};
+
+struct wherefilter {
+	std::vector<wherestep> steps;
+	std::vector<char> stack;						// as deep as the steps need
 
-static byte* s_pHeaderEnd;							// point to end of headers for later processing
+	void compile(const whereexpr& expr, const column* columns, unsigned nColumns);
+	bool test(const datarec& rec);
 
+private:
+	void emit(const whereexpr& expr, unsigned iNode, const column* columns, unsigned nColumns, unsigned nDepth);
+};
 
+// What a name in a --where expression stands for: a column title, or CHT, EGT
+// or TIT for every cylinder's (C1, E1, T1...)
+static bool wherefield(const char* szWant, const char* szName)
+{
+	if (strcmp(szWant, szName) == 0)
+		return true;
+	if (!isdigit((byte)szName[1]))
+		return false;
+	switch (szName[0]) {
+	case 'C': return strcmp(szWant, "CHT") == 0;
+	case 'E': return strcmp(szWant, "EGT") == 0;
+	case 'T': return strcmp(szWant, "TIT") == 0;
+	}
+	return false;
+}
 
-// initialize various module variables
-static void reset_vars()
+// With an L or R in front, just one engine's (L being the only one of a
+// single). Names that don't start with them are tried whole first, for RPM.
+static bool wherematch(const char* szWant, const column& col)
 {
-	tailnum[0] = 0;
-	memset(&limits, 0, sizeof(limits));
-	memset(&config, 0, sizeof(config));
-	memset(&fuel, 0, sizeof(fuel));
-	memset(&timestamp, 0, sizeof(timestamp));
-	headerend = 0;
-	memset(flightlist, 0, sizeof(flightlist));
-	s_nFlights = 0;
-	s_pHeaderEnd = NULL;
-	s_NewVersion = 0;
-	s_szOldVer = NULL;
+	if (wherefield(szWant, col.szName))
+		return true;
+	if ((szWant[0] == 'L' && col.szEng[0] != 'R') || (szWant[0] == 'R' && col.szEng[0] == 'R'))
+		return wherefield(szWant + 1, col.szName);
+	return false;
 }
 
+// The value a comparison is with, in the column's units (tenths for some), as
+// an integer that gives the same answer for every short as the exact value
+static const int NO_SHORT = 0x10000;					// one no value is equal to
 
-//
-// Compute the checksum on the textual file header records
-//
-static void test_header_checksum(const char* line)
+static int wherevalue(whereop op, double value, unsigned nScale)
 {
-	assert(line);
-	const char* endp = strrchr(line, '*');
-	const char* p = line + 1;
+	double x = value * nScale;
+	x = max(-(double)NO_SHORT, min((double)NO_SHORT, x));
+	double whole = floor(x + 0.5);
+	if (fabs(x - whole) < 1e-6)
+		x = whole;											// 40.1 * 10 is just over 401
+	switch (op) {
+	case WHERE_GT:
+	case WHERE_LE:
+		return (int)floor(x);
+	case WHERE_LT:
+	case WHERE_GE:
+		return (int)ceil(x);
+	default:
+		return (x == whole) ? (int)x : NO_SHORT;
+	}
+}
 
-	if (!endp || *endp != '*')
-		errexit("Header checksum format error: %s\n", line);
+void wherefilter::compile(const whereexpr& expr, const column* columns, unsigned nColumns)
+{
+	steps.clear();
+	stack.clear();
+	emit(expr, expr.root, columns, nColumns, 0);
+}
 
-	ushort testval;
-	byte cs = 0;
-	if (sscanf(endp + 1, "%hx", &testval) != 1)
-		errexit("Header checksum format error: %s\n", line);
-	while (p < endp)
-		cs ^= *p++;
-	if (testval != cs)
-		errexit("Header checksum failed: %s", line);
+// Add the steps for a node, leaving its answer on the stack above the nDepth
+// already there
+void wherefilter::emit(const whereexpr& expr, unsigned iNode, const column* columns, unsigned nColumns, unsigned nDepth)
+{
+	const wherenode& node = expr.nodes[iNode];
+	wherestep step = { node.op, 0, NO_NABIT, 0 };
+	switch (node.op) {
+	case WHERE_AND:
+	case WHERE_OR:
+		emit(expr, node.a, columns, nColumns, nDepth);
+		emit(expr, node.b, columns, nColumns, nDepth + 1);
+		steps.push_back(step);
+		break;
+	case WHERE_NOT:
+		emit(expr, node.a, columns, nColumns, nDepth);
+		steps.push_back(step);
+		break;
+	default: {
+		unsigned nMatched = 0;
+		for (unsigned i = 0; i < nColumns; i++) {
+			if (!wherematch(node.name.c_str(), columns[i]))
+				continue;
+			step.op = node.op;
+			step.nOffset = columns[i].nOffset;
+			step.nNABit = columns[i].nNABit;
+			step.nValue = wherevalue(node.op, node.value, columns[i].nScale);
+			steps.push_back(step);
+			if (nMatched++) {
+				wherestep either = { WHERE_OR, 0, NO_NABIT, 0 };
+				steps.push_back(either);
+			}
+			if (stack.size() < nDepth + 2)
+				stack.resize(nDepth + 2);
+		}
+		if (!nMatched) {
+			step.op = WHERE_FALSE;
+			steps.push_back(step);
+		}
+		if (stack.size() < nDepth + 1)
+			stack.resize(nDepth + 1);
+		break;
+	}
+	}
 }
 
-//
-// Helper to parse a list of short values, which is most
-// of the text header records.
-//
-static void parseshorts(void* results, const void* line_in, unsigned count)
+bool wherefilter::test(const datarec& rec)
 {
-	const char* line = reinterpret_cast<const char*>(line_in);
-	assert(results != NULL && count > 0);
-	assert(line != NULL && *line == '$');		// start from beginning of record
-	ushort* sresults = static_cast<ushort*>(results);
-	line = strchr(line, ',');						// skip $X header
-	for (unsigned i = 0; i < count; i++) {
-		if (!sscanf(line, ",%hu", sresults + i))
-			errexit("Not enough values (%d): %s\n", count, line_in);
-		line = strchr(line + 1, ',');					// this will be null on last iteration
+	char* sp = stack.data();
+	for (size_t i = 0; i < steps.size(); i++) {
+		const wherestep& step = steps[i];
+		int s = rec.sarray[step.nOffset];
+		switch (step.op) {
+		case WHERE_LT: *sp++ = s < step.nValue; break;
+		case WHERE_LE: *sp++ = s <= step.nValue; break;
+		case WHERE_GT: *sp++ = s > step.nValue; break;
+		case WHERE_GE: *sp++ = s >= step.nValue; break;
+		case WHERE_EQ: *sp++ = s == step.nValue; break;
+		case WHERE_NE: *sp++ = s != step.nValue; break;
+		case WHERE_AND: sp--; sp[-1] &= sp[0]; continue;
+		case WHERE_OR: sp--; sp[-1] |= sp[0]; continue;
+		case WHERE_NOT: sp[-1] = !sp[-1]; continue;
+		case WHERE_FALSE: *sp++ = false; continue;
+		}
+		if (step.nNABit != NO_NABIT && testbit(rec.naflags, step.nNABit))
+			sp[-1] = false;
 	}
+	assert(sp == stack.data() + 1);
+	return stack[0] != 0;
 }
 
 
-// parse out the relevent bits of the header
-static void parse_headers(void)
-{
-	byte* lf;
-	byte* line;
 
-	for (line = s_pFileBytes; line < s_pFileBytes + s_nFileBytes && (lf = (byte*)memchr(line, '\r', s_nFileBytes)); line = lf) {
-		assert(*lf == '\r' && *(lf + 1) == '\n');
-		pushpop<byte> savecr(lf, 0);				// terminate line temporarily
+//
+// Arrow IPC output (--format arrow). Each flight is written as an Arrow IPC
+// file, Fnnnnn.arrow, with the same columns as its CSV file: TIME as a UTC
+// timestamp, the values as int16 columns (decimal ones for values kept in
+// tenths) with nulls where the CSV would say "NA", and MARK as a boolean.
+// Rows go out in record batches of ARROW_BATCH_ROWS as they're decoded, so a
+// flight is never held in memory, and the result can be memory mapped and
+// used as it is by anything that reads Arrow.
+//
+// The Arrow metadata is FlatBuffers, and fbbuilder is just enough of a
+// FlatBuffers builder to write it. Everything goes in front to back: a table
+// is added with its offset fields left empty, and link() points each one at
+// the table, vector or string added after it.
+//
+class fbbuilder {
+public:
+	std::string buf;
 
-		lf += 2;											// point to next record
+	// A scalar of 1, 2, 4 or 8 bytes, or (size 4) an offset to link()
+	struct field {
+		ushort id;
+		ushort size;
+		int64_t value;
+	};
 
-		// check the checksum
-		test_header_checksum((const char*)line);
+	fbbuilder() { put<uint32_t>(0); }				// the root table offset, see root()
 
-		// maybe print the line
-#ifdef DBGOPTS
-		if (s_bDisplayHeaders)
-			printf("%s\n", line);
-#endif
+	size_t size(void) const { return buf.size(); }
+	void pad(size_t align) { buf.append((align - buf.size() % align) % align, '\0'); }
+	void put(const void* p, size_t n) { buf.append((const char*)p, n); }
+	template <class T> void put(T v) { put(&v, sizeof(v)); }
 
-		// parse the pieces into separate strings, comma delimited (and strip the trailing *xx "checksum")
-		if (*line != '$')
-			errexit("Expected $ at beginning of record:\n --> %s", line);
-
-		switch (*(line + 1)) {
-		case 'U': // tail number
-			line += 3;									// skip past comma
-			int i;
-			for (i = 0; i < sizeof(tailnum) - 1 && *line && *line != '*'; i++)
-				tailnum[i] = *line++ ;
-				tailnum[i] = 0 ;
-			break;
-		case 'A': // limits info
-			parseshorts(&limits, line, 8);
-			break;
-		case 'F': // fuel flow config info
-			parseshorts(&fuel, line, 5);
-			break;
-		case 'T': // timestamp info
-			parseshorts(&timestamp, line, 6);
-			break;
-		case 'C': // instrument configuration info
-			parseshorts(&config, line, 5);
-
-			// find which firmware version is "new" for this model of instrument
-			s_NewVersion = newmodeltable[countof(newmodeltable) - 1].newversion;
-			s_szOldVer = newmodeltable[countof(newmodeltable) - 1].oldverstring;
-			for (int i = 0; i < countof(newmodeltable); i++) {
-				if (newmodeltable[i].model == config.model) {
-					s_NewVersion = newmodeltable[i].newversion;
-					s_szOldVer = newmodeltable[i].oldverstring;
-					break;
-				}
-			}
-			assert(s_NewVersion != 0 && s_szOldVer != NULL);
-
-			// HACK - change the version now while we're pointing at it
-			// in case we write this line back out using the -r program 
-			// option.
-			if (config.firmware_version >= s_NewVersion) {
-				char* p = (char*)(line + 1);
-				char* ver = strrchr(p, ',');
-				char* endp = strrchr(p, '*');
-				if (!ver++ || !endp) // basic error check
-					break;
-				while (*ver == ' ') ver++; // skip spaces
-				if (endp - ver != 3) // basic error check
-					break;
-
-				memcpy(ver, s_szOldVer, 3);
-				ver += 3;
-				byte cs = 0;
-				while (p < endp)
-					cs ^= *p++;
-				char buf[8];
-				sprintf(buf, "%02X", cs);
-				endp++;
-				*endp++ = buf[0];
-				*endp++ = buf[1];
-			}
-			break;
-		case 'L': // end of headers, unknown meaning
-			parseshorts(&headerend, line, 1);
+	void link(size_t at, size_t target) {
+		uint32_t off = (uint32_t)(target - at);
+		memcpy(&buf[at], &off, sizeof(off));
+	}
+	void root(size_t target) { link(0, target); }
 
-			// Save end of headers for other funcs
-			s_pHeaderEnd = lf;
+	size_t table(const field* fields, unsigned nFields, size_t* fieldpos);
+	size_t vec(size_t count, size_t eltsize, size_t eltalign, const void* elts);
+	size_t str(const char* s);
+};
 
-			// NOTE: Normal exit path of function!
-			return;
+// A table goes in as its vtable followed by the table itself, with the fields
+// biggest first so each is aligned. fieldpos gets where each field went.
+size_t fbbuilder::table(const field* fields, unsigned nFields, size_t* fieldpos)
+{
+	ushort vtable[2 + 8];
+	unsigned nIds = 0;
+	bool bWide = false;
+	unsigned i;
 
-		case 'D': // flight info
-			if (s_nFlights >= countof(flightlist))
-				errexit("This program can only handle %d flights per file", countof(flightlist));
-			parseshorts(&flightlist[s_nFlights++], line, 2);
-			break;
-		default:
-			printf("Unrecognized header record:\n --> %s\n", line);
-			break;
+	memset(vtable, 0, sizeof(vtable));
+	for (i = 0; i < nFields; i++) {
+		nIds = max(nIds, fields[i].id + 1u);
+		bWide |= (fields[i].size == 8);
+	}
+	assert(nIds <= countof(vtable) - 2);
+	ushort nInline = sizeof(int32_t);				// the vtable offset comes first
+	for (unsigned nSize = 8; nSize; nSize /= 2) {
+		for (i = 0; i < nFields; i++) {
+			if (fields[i].size == nSize) {
+				vtable[2 + fields[i].id] = nInline;
+				nInline += nSize;
+			}
+		}
+	}
+	vtable[0] = (ushort)((2 + nIds) * sizeof(ushort));
+	vtable[1] = nInline;
+
+	pad(2);
+	size_t vtpos = size();
+	put(vtable, vtable[0]);
+	pad(4);
+	if (bWide && size() % 8 != 4)
+		put<uint32_t>(0);
+	size_t pos = size();
+	put<int32_t>((int32_t)(pos - vtpos));
+	for (unsigned nSize = 8; nSize; nSize /= 2) {
+		for (i = 0; i < nFields; i++) {
+			if (fields[i].size == nSize) {
+				if (fieldpos)
+					fieldpos[i] = size();
+				put(&fields[i].value, nSize);		// little endian, like Arrow
+			}
 		}
 	}
+	return pos;
+}
 
-	// Note that this is not the typical exit path of the function, we SHOULD
-	// find the 'L' record and return from there. This is the error exit path.
-	errexit("Unexpected end of .DAT file");
+// A vector's length comes right before its elements, which are aligned to
+// eltalign. Leaving elts NULL zeroes them, for a vector of offsets to link().
+size_t fbbuilder::vec(size_t count, size_t eltsize, size_t eltalign, const void* elts)
+{
+	pad(4);
+	if ((size() + 4) % max(eltalign, (size_t)4))
+		put<uint32_t>(0);
+	size_t pos = size();
+	put<uint32_t>((uint32_t)count);
+	if (elts)
+		put(elts, count * eltsize);
+	else
+		buf.append(count * eltsize, '\0');
+	return pos;
 }
 
-static void decode_datebits(ushort dt, ushort* m, ushort* d, ushort* y)
+size_t fbbuilder::str(const char* s)
+{
+	pad(4);
+	size_t pos = size();
+	size_t n = strlen(s);
+	put<uint32_t>((uint32_t)n);
+	put(s, n + 1);										// and its NUL
+	return pos;
+}
+
+// Values from the Arrow format's Schema.fbs and Message.fbs
+static const short ARROW_METADATA_V5 = 4;
+static const byte ARROW_MSG_SCHEMA = 1;
+static const byte ARROW_MSG_RECORDBATCH = 3;
+static const byte ARROW_TYPE_INT = 2;
+static const byte ARROW_TYPE_BOOL = 6;
+static const byte ARROW_TYPE_DECIMAL = 7;
+static const byte ARROW_TYPE_TIMESTAMP = 10;
+
+static const unsigned ARROW_BATCH_ROWS = 16384;
+
+class arrowwriter {
+	outwriter& out;
+	const column* columns;
+	unsigned nColumns;
+	std::vector<std::pair<std::string, std::string> > meta;	// schema metadata
+	int64_t nWritten;									// file offset
+
+	// Where a record batch is, as the file footer lists them
+	struct block {
+		int64_t nOffset;
+		int32_t nMetaLength;
+		int32_t pad;
+		int64_t nBodyLength;
+	};
+	std::vector<block> batches;
+
+	// The batch being filled, a column at a time
+	unsigned nBatch;									// rows in it
+	std::vector<int64_t> times;
+	std::vector<short> values;						// ARROW_BATCH_ROWS for each column
+	std::vector<byte> valid;							// validity bits, likewise
+	std::vector<unsigned> nNulls;
+	std::vector<byte> marks;
+
+	void put(const void* p, size_t n) {
+		out.write((const char*)p, n);
+		nWritten += n;
+	}
+	void pad(void);
+	size_t startmessage(fbbuilder& fb, byte nHeaderType, int64_t nBodyLength);
+	block writemessage(fbbuilder& fb, int64_t nBodyLength);
+	size_t putschema(fbbuilder& fb);
+	size_t putfield(fbbuilder& fb, unsigned iField);
+	void writebatch(void);
+
+public:
+	arrowwriter(outwriter& o, const column* cols, unsigned n);
+
+	void addmeta(const char* key, const char* value) { meta.push_back(std::make_pair(std::string(key), std::string(value))); }
+	void begin(void);
+	void addrow(time_t t, const datarec& rec);
+	void end(void);
+};
+
+arrowwriter::arrowwriter(outwriter& o, const column* cols, unsigned n)
+	: out(o), columns(cols), nColumns(n), nWritten(0), nBatch(0),
+	times(ARROW_BATCH_ROWS), values(n * ARROW_BATCH_ROWS), valid(n * ARROW_BATCH_ROWS / 8),
+	nNulls(n), marks(ARROW_BATCH_ROWS / 8)
+{
+}
+
+// Zeroes up to the next 8 byte boundary, which every buffer in a body starts on
+void arrowwriter::pad(void)
+{
+	static const byte zeroes[8] = { 0 };
+	put(zeroes, (8 - nWritten % 8) % 8);
+}
+
+// Start off the flatbuffer with a Message, returning where to link() its header
+size_t arrowwriter::startmessage(fbbuilder& fb, byte nHeaderType, int64_t nBodyLength)
+{
+	const fbbuilder::field fields[] = { {0, 2, ARROW_METADATA_V5}, {1, 1, nHeaderType}, {2, 4, 0}, {3, 8, nBodyLength} };
+	size_t at[countof(fields)];
+	fb.root(fb.table(fields, countof(fields), at));
+	return at[2];
+}
+
+// Write out a message's metadata with the continuation marker and length in
+// front of it, padded so that the body following it is aligned
+arrowwriter::block arrowwriter::writemessage(fbbuilder& fb, int64_t nBodyLength)
+{
+	fb.pad(8);
+	block blk = { nWritten, (int32_t)(2 * sizeof(int32_t) + fb.size()), 0, nBodyLength };
+	int32_t prefix[2] = { -1, (int32_t)fb.size() };
+	put(prefix, sizeof(prefix));
+	put(fb.buf.data(), fb.size());
+	return blk;
+}
+
+// The schema, which is in the file twice: in the first message and the footer
+size_t arrowwriter::putschema(fbbuilder& fb)
+{
+	const fbbuilder::field fields[] = { {1, 4, 0}, {2, 4, 0} };	// fields, custom_metadata
+	size_t at[countof(fields)];
+	size_t pos = fb.table(fields, countof(fields), at);
+
+	unsigned nFields = 1 + nColumns + 1;			// TIME, the values, MARK
+	size_t list = fb.vec(nFields, sizeof(uint32_t), sizeof(uint32_t), NULL);
+	fb.link(at[0], list);
+	for (unsigned i = 0; i < nFields; i++)
+		fb.link(list + sizeof(uint32_t) * (1 + i), putfield(fb, i));
+
+	list = fb.vec(meta.size(), sizeof(uint32_t), sizeof(uint32_t), NULL);
+	fb.link(at[1], list);
+	for (unsigned i = 0; i < meta.size(); i++) {
+		const fbbuilder::field kvfields[] = { {0, 4, 0}, {1, 4, 0} };
+		size_t kvat[countof(kvfields)];
+		fb.link(list + sizeof(uint32_t) * (1 + i), fb.table(kvfields, countof(kvfields), kvat));
+		fb.link(kvat[0], fb.str(meta[i].first.c_str()));
+		fb.link(kvat[1], fb.str(meta[i].second.c_str()));
+	}
+	return pos;
+}
+
+size_t arrowwriter::putfield(fbbuilder& fb, unsigned iField)
+{
+	std::string name;
+	byte nType;
+	bool bNullable = false;
+	unsigned nScale = 1;
+
+	if (iField == 0) {
+		name = "TIME";
+		nType = ARROW_TYPE_TIMESTAMP;
+	}
+	else if (iField > nColumns) {
+		name = fielddesc[MARK_FIELD].szName;
+		nType = ARROW_TYPE_BOOL;
+	}
+	else {
+		const column& col = columns[iField - 1];
+		name = std::string(col.szEng) + col.szName;
+		nType = (col.nScale == 1) ? ARROW_TYPE_INT : ARROW_TYPE_DECIMAL;
+		bNullable = (col.nNABit != NO_NABIT);
+		nScale = col.nScale;
+	}
+
+	// name, nullable, type (a union, so its type then the table), children
+	const fbbuilder::field fields[] = { {0, 4, 0}, {1, 1, bNullable}, {2, 1, nType}, {3, 4, 0}, {5, 4, 0} };
+	size_t at[countof(fields)];
+	size_t pos = fb.table(fields, countof(fields), at);
+	fb.link(at[0], fb.str(name.c_str()));
+
+	size_t type;
+	if (nType == ARROW_TYPE_TIMESTAMP) {
+		const fbbuilder::field typefields[] = { {0, 2, 0 /* seconds */}, {1, 4, 0} };	// unit, timezone
+		size_t typeat[countof(typefields)];
+		type = fb.table(typefields, countof(typefields), typeat);
+		fb.link(typeat[1], fb.str("UTC"));
+	}
+	else if (nType == ARROW_TYPE_INT) {
+		const fbbuilder::field typefields[] = { {0, 4, 16}, {1, 1, true} };	// bitWidth, is_signed
+		type = fb.table(typefields, countof(typefields), NULL);
+	}
+	else if (nType == ARROW_TYPE_DECIMAL) {
+		int nDigits = 0;
+		for (unsigned n = nScale; n > 1; n /= 10)
+			nDigits++;
+		const fbbuilder::field typefields[] = { {0, 4, 5}, {1, 4, nDigits}, {2, 4, 128} };	// precision, scale, bitWidth
+		type = fb.table(typefields, countof(typefields), NULL);
+	}
+	else
+		type = fb.table(NULL, 0, NULL);
+	fb.link(at[3], type);
+	fb.link(at[4], fb.vec(0, sizeof(uint32_t), sizeof(uint32_t), NULL));
+	return pos;
+}
+
+void arrowwriter::begin(void)
+{
+	put("ARROW1\0", 8);
+	fbbuilder fb;
+	size_t header = startmessage(fb, ARROW_MSG_SCHEMA, 0);
+	fb.link(header, putschema(fb));
+	writemessage(fb, 0);
+}
+
+void arrowwriter::addrow(time_t t, const datarec& rec)
+{
+	unsigned iByte = nBatch / 8;
+	byte bit = (byte)(1 << nBatch % 8);
+
+	times[nBatch] = t;
+	for (unsigned i = 0; i < nColumns; i++) {
+		const column& col = columns[i];
+		if (col.nNABit != NO_NABIT && testbit(rec.naflags, col.nNABit)) {
+			values[i * ARROW_BATCH_ROWS + nBatch] = 0;
+			nNulls[i]++;
+		}
+		else {
+			values[i * ARROW_BATCH_ROWS + nBatch] = rec.sarray[col.nOffset];
+			valid[i * ARROW_BATCH_ROWS / 8 + iByte] |= bit;
+		}
+	}
+	if (rec.mark)
+		marks[iByte] |= bit;
+
+	if (++nBatch == ARROW_BATCH_ROWS)
+		writebatch();
+}
+
+void arrowwriter::writebatch(void)
+{
+	struct fieldnode {
+		int64_t nLength;
+		int64_t nNulls;
+	};
+	struct buffer {
+		int64_t nOffset;
+		int64_t nLength;
+	};
+	std::vector<fieldnode> nodes;
+	std::vector<buffer> buffers;
+	int64_t nBody = 0;
+	size_t nBits = (nBatch + 7) / 8;
+
+	// Each column has a validity bitmap, left empty when there are no nulls,
+	// and then its values
+	auto addcolumn = [&](unsigned nNullCount, size_t nValues) {
+		fieldnode node = { nBatch, nNullCount };
+		nodes.push_back(node);
+		buffer bitmap = { nBody, (int64_t)(nNullCount ? nBits : 0) };
+		buffers.push_back(bitmap);
+		nBody += (bitmap.nLength + 7) & ~7;
+		buffer vals = { nBody, (int64_t)nValues };
+		buffers.push_back(vals);
+		nBody += (vals.nLength + 7) & ~7;
+	};
+	addcolumn(0, nBatch * sizeof(int64_t));
+	for (unsigned i = 0; i < nColumns; i++)
+		addcolumn(nNulls[i], nBatch * ((columns[i].nScale == 1) ? sizeof(short) : 2 * sizeof(int64_t)));
+	addcolumn(0, nBits);
+
+	fbbuilder fb;
+	size_t header = startmessage(fb, ARROW_MSG_RECORDBATCH, nBody);
+	const fbbuilder::field fields[] = { {0, 8, nBatch}, {1, 4, 0}, {2, 4, 0} };	// length, nodes, buffers
+	size_t at[countof(fields)];
+	fb.link(header, fb.table(fields, countof(fields), at));
+	fb.link(at[1], fb.vec(nodes.size(), sizeof(fieldnode), sizeof(int64_t), &nodes[0]));
+	fb.link(at[2], fb.vec(buffers.size(), sizeof(buffer), sizeof(int64_t), &buffers[0]));
+	batches.push_back(writemessage(fb, nBody));
+
+	// Then the body, in the same order
+	put(&times[0], nBatch * sizeof(int64_t));
+	pad();
+	for (unsigned i = 0; i < nColumns; i++) {
+		if (nNulls[i]) {
+			put(&valid[i * ARROW_BATCH_ROWS / 8], nBits);
+			pad();
+		}
+		const short* pValues = &values[i * ARROW_BATCH_ROWS];
+		if (columns[i].nScale == 1)
+			put(pValues, nBatch * sizeof(short));
+		else {
+			// 128 bit integers, in units of the scale
+			int64_t dec[2 * 64];
+			for (unsigned r = 0; r < nBatch; ) {
+				unsigned n = min(nBatch - r, 64u);
+				for (unsigned k = 0; k < n; k++) {
+					dec[2 * k] = pValues[r + k];
+					dec[2 * k + 1] = (pValues[r + k] < 0) ? -1 : 0;
+				}
+				put(dec, n * 2 * sizeof(int64_t));
+				r += n;
+			}
+		}
+		pad();
+	}
+	put(&marks[0], nBits);
+	pad();
+
+	nBatch = 0;
+	memset(&valid[0], 0, valid.size());
+	memset(&marks[0], 0, marks.size());
+	nNulls.assign(nColumns, 0);
+}
+
+// Write out what's left, then the footer that makes it an Arrow file rather
+// than just a stream
+void arrowwriter::end(void)
+{
+	if (nBatch)
+		writebatch();
+	int32_t eos[2] = { -1, 0 };
+	put(eos, sizeof(eos));
+
+	fbbuilder fb;
+	const fbbuilder::field fields[] = { {0, 2, ARROW_METADATA_V5}, {1, 4, 0}, {2, 4, 0}, {3, 4, 0} };	// version, schema, dictionaries, recordBatches
+	size_t at[countof(fields)];
+	fb.root(fb.table(fields, countof(fields), at));
+	fb.link(at[1], putschema(fb));
+	fb.link(at[2], fb.vec(0, sizeof(block), sizeof(int64_t), NULL));
+	fb.link(at[3], fb.vec(batches.size(), sizeof(block), sizeof(int64_t), batches.empty() ? NULL : &batches[0]));
+	put(fb.buf.data(), fb.size());
+	int32_t nFooter = (int32_t)fb.size();
+	put(&nFooter, sizeof(nFooter));
+	put("ARROW1", 6);
+}
+
+
+
+//
+// The time of the rows in a flight only ever goes forward, an interval at a
+// time, so rather than a localtime() call for every row the local time is
+// looked up at the start of each hour and the minutes and seconds are
+// counted from there. DST changes are mostly on the hour, but not everywhere
+// (some zones change by half an hour, or at the half hour), so the end of the
+// hour is looked up too, and if it isn't what the counting gives the hour is
+// cut short at the change. With -u it's simpler yet, with the date only
+// worked out when a new day starts.
+//
+struct rowclock {
+	bool bUTC;
+	time_t tBase;										// start of the hour (or UTC day) known...
+	time_t tNext;										// ...and the end of it (or a DST change)
+	ushort yr, mon, day;								// UTC date
+	ushort hh;											// hour at tBase
+
+	rowclock(bool bUseUTC) : bUTC(bUseUTC), tBase(0), tNext(0), yr(0), mon(0), day(0), hh(0) {}
+	void get(time_t t, ushort& h, ushort& m, ushort& s);
+};
+
+
+//
+// Everything known about one .DAT file while it's being translated. Each
+// file on the command line gets its own, so a batch of files can be worked
+// on in parallel (see -j).
+//
+
+// Thrown by fileerr() to give up on the current file or flight
+struct fileabort {};
+
+// Console output, held back in batch mode so that related lines stay together
+struct msglog {
+	std::string log;
+	bool bHoldOutput;
+	bool bFailed;
+
+	msglog(bool bHold) : bHoldOutput(bHold), bFailed(false) {}
+	void print(const char* msg, ...);
+	void fileerr(const char* msg, ...);
+};
+
+// A byte of the file that -r changes
+struct patch {
+	size_t nOffset;
+	byte b;
+};
+
+//
+// For --stats, where the time goes in translating a file and how much of it
+// there was. Each flight keeps its own, which are added to the file's when
+// the flights are done. Without --stats there's nothing to time, and a
+// phasetimer is just a test of a NULL pointer.
+//
+enum phase { PHASE_READ, PHASE_HEADERS, PHASE_DECODE, PHASE_FORMAT, PHASE_WRITE, NUM_PHASES };
+static const char* const s_phasenames[NUM_PHASES] = { "read", "headers", "decode", "format", "write" };
+
+struct runstats {
+	double secs[NUM_PHASES];						// added up over the flights, which -j can overlap
+	double wallsecs;									// start to finish
+	uint64_t nBytes;
+	uint64_t nFlights;
+	uint64_t nRecords;								// data records decoded
+	uint64_t nRepeats;								// rows that were repeats of a data record
+	uint64_t nRows;									// rows written
+	uint64_t nChecksumErrors;
+	unsigned nFiles;
+
+	runstats() { memset(this, 0, sizeof(*this)); }
+	void add(const runstats& s);
+	void report(msglog& out, const char* szFilename, bool bJson) const;
+};
+
+// Adds the time from its construction to its destruction to one phase
+class phasetimer {
+	double* pSecs;
+	std::chrono::steady_clock::time_point tStart;
+
+public:
+	phasetimer(runstats* pStats, phase ph) : pSecs(pStats ? &pStats->secs[ph] : NULL) {
+		if (pSecs)
+			tStart = std::chrono::steady_clock::now();
+	}
+	~phasetimer() {
+		if (pSecs) {
+			std::chrono::duration<double> secs = std::chrono::steady_clock::now() - tStart;
+			*pSecs += secs.count();
+		}
+	}
+};
+
+struct datfile : msglog, jpiheaders {
+	options opts;										// switches in effect for this file
+	unsigned nJob;										// position in the batch
+
+	// File contents
+	const byte* pFileBytes;
+	size_t nFileBytes;
+	bool bMapped;										// pFileBytes is a file mapping rather than malloc'd
+	char szCurrFile[_MAX_PATH];
+	time_t tModified;
+
+	// For -t, where each flight's decoding can start part way in (see load_index())
+	std::vector<std::vector<jpikeyframe> > keyframes;
+	std::vector<bool> indexed;						// keyframes[i] has been worked out
+
+	runstats stats;									// for --stats, and the flights' added in
+	runstats* pStats;									// &stats with --stats, otherwise NULL
+
+	std::vector<std::string> summaries;			// --summary lines of the flights, in order
+	std::vector<std::string> exceedances;		// --exceedances events of each flight
+
+	// The header records themselves are in jpiheaders. The file bytes are
+	// never changed, even by -r, which writes the changes to a copy.
+	const byte* pHeaderEnd;							// point to end of headers for later processing
+
+	datfile(const options& o, const char* szFilename, unsigned nJobNum, bool bHold);
+	~datfile();
+
+	void translate(void);
+	void translate_file(void);
+	void write_report(const char* szSuffix, const std::string& heading, const std::vector<std::string>& lines);
+	void write_summary(void);
+
+	int open_file(void);
+	void read_file(int fd, size_t nbytes);
+	bool map_file(int fd, size_t nbytes);
+	void unmap_file(void);
+	void stream_file(int fd);
+	void setdir(const char* basenam, char* outname, size_t outsize) const;
+	void write_file(const char* szFilename, const void* bytes, size_t nbytes);
+	void copy_file(const char* szTo);
+	void catalog(int fd, size_t nbytes);
+	bool parse_header(char* linebuf, size_t nLine, size_t nOffset);
+	void parse_headers(void);
+	void parse_data(void);
+	void load_index(void);
+	bool read_index(const char* szIndex);
+	void write_index(const char* szIndex) const;
+	void find_keyframes(unsigned iFlight);
+	void recompute_checksums(void);
+	jpistatus old_checksums(unsigned iFlight, std::vector<patch>& patches) const;
+	bool old_checksum(const byte* pRec, const byte* pCheck, std::vector<patch>& patches) const;
+	void write_patched_file(const char* szSuffix, const char* szExt, const std::vector<std::vector<patch> >& patches);
+};
+
+//
+// Translating one flight of a .DAT file to its CSV file. The flights in a file
+// don't depend on each other, so each gets its own of these and they can be
+// translated in parallel. The decoding itself is jpiflight's.
+//
+struct flightctx : msglog, jpiflight {
+	const datfile& file;
+	const options& opts;
+	const byte* pTop;									// flight data, from the flight header...
+	const byte* pEnd;									// ...to the start of the next flight (NULL when streaming)
+	unsigned iFlight;
+
+	// Timing of the rows, carried from one data record to the next
+	time_t t;
+	time_t tStart;										// time of the first row
+	time_t tFrom, tTo;								// the rows wanted, with -t
+	time_t tFirstRow, tLastRow;					// the rows written, with -t
+	rowclock rowtime;
+
+	column columns[MAX_COLUMNS];					// see plancolumns()
+	unsigned nColumns;
+
+	// With --where, the rows to keep
+	wherefilter where;
+	bool bWhereCurrent;								// bWhereMatch is for rec
+	bool bWhereMatch;
+
+	// CSV row being put together, see formatdata()
+	char rowbuf[512];									// should be ample
+	bool bValuesCurrent;								// the values in rowbuf are for rec
+	unsigned long nRows;
+	unsigned long nCachedRows;						// rows that reused the values already in rowbuf
+
+	runstats stats;									// this flight's, for --stats
+	runstats* pStats;									// &stats with --stats, otherwise NULL
+
+	// Or with --summary, the flight's line of the summary file
+	flightsummary summary;
+	std::string summaryline;
+
+	// And with --exceedances, its events
+	flightlimits limits;
+	bool bFinished;									// finish() is done, so the above are complete
+
+	// CSV output, or an Arrow file with --format arrow
+	outwriter OutputCSV;
+	char szOutputCSV[_MAX_PATH];					// final name, when OutputCSV is a temp file
+	char szTempCSV[_MAX_PATH];
+	std::unique_ptr<arrowwriter> pArrow;
+#ifdef DBGOPTS
+	FILE* fCompareCSV;
+#endif
+	long DurationOffset;
+
+	flightctx(const datfile& f, unsigned iFlight, const byte* top, const byte* end);
+	~flightctx() { closecsv(false); }
+
+	void translate(void);
+	void check(jpistatus st);
+
+	// The pieces of translate(), for decoding a stream a record at a time
+	// (after jpiflight::read_header())
+	void start(void);
+	void decode_record(const byte* p, size_t nbytes);
+	void finish(void);
+
+	void plancolumns(void);
+	const char* formatdata(void);
+	char* formattime(char* p, time_t tRow);
+#ifdef DBGOPTS
+	void formatdata_printf(char* outbuf, size_t outsize) const;
+#endif
+	void opencsv(ushort flightnum);
+	void closecsv(bool bKeep = true);
+	void outputline(const char* line, bool bsuppressdiff = false);
+	void outputrow(void);
+	void nextrow(void);
+	void outputheaders(const flightheader& fhead);
+	void outputschema(const flightheader& fhead);
+	void write_duration(time_t tFirst, time_t tLast);
+	void addsummary(void);
+	void flushsummary(void);
+	void formatsummary(void);
+	void planlimits(void);
+	void checklimits(void);
+	void gaplimits(void);
+	void checklimit(limitcheck& check, short s);
+	void endevent(limitcheck& check, time_t tLast);
+#ifdef DBGOPTS
+	void dumpflightheader(const flightheader& fhead);
+	void dumprecord(const byte* pDataRec, size_t nbytes);
+#endif
+};
+
+static std::mutex s_consolelock;					// keeps batch output from interleaving
+
+datfile::datfile(const options& o, const char* szFilename, unsigned nJobNum, bool bHold)
+	: msglog(bHold), opts(o), nJob(nJobNum)
+{
+	assert(szFilename != NULL && strlen(szFilename) < sizeof(szCurrFile));
+	pFileBytes = NULL;
+	nFileBytes = 0;
+	bMapped = false;
+	strcpy(szCurrFile, szFilename);
+	tModified = 0;
+	pHeaderEnd = NULL;
+	pStats = opts.bStats ? &stats : NULL;
+	stats.nFiles = 1;
+}
+
+datfile::~datfile()
+{
+	unmap_file();
+	if (!log.empty()) {
+		std::lock_guard<std::mutex> held(s_consolelock);
+		fputs(log.c_str(), stdout);
+	}
+}
+
+void msglog::print(const char* msg, ...)
+{
+	assert(msg != NULL);
+	va_list args;
+	va_start(args, msg);
+	if (bHoldOutput) {
+		char buf[1024];
+		vsnprintf(buf, sizeof(buf), msg, args);
+		log += buf;
+	}
+	else
+		vprintf(msg, args);
+	va_end(args);
+}
+
+// Fatal error for this file or flight - give message and stop working on it
+void msglog::fileerr(const char* msg, ...)
+{
+	assert(msg != NULL);
+	char buf[1024];
+	va_list args;
+	va_start(args, msg);
+	vsnprintf(buf, sizeof(buf), msg, args);
+	va_end(args);
+	print("%s%s", buf, (*buf && buf[strlen(buf) - 1] == '\n') ? "" : "\n");
+	throw fileabort();
+}
+
+// Translate the file (or recompute its checksums for -r)
+void datfile::translate(void)
+{
+	const char* szName = strcmp(szCurrFile, "-") ? szCurrFile : "(standard input)";
+	if (!opts.bCatalog)
+		print("%s\n", szName);
+	std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+	try {
+		translate_file();
+	}
+	catch (const fileabort&) {
+		bFailed = true;
+	}
+
+	// The flights gone through before any trouble still get reported
+	try {
+		if (!summaries.empty())
+			write_summary();
+		if (!exceedances.empty()) {
+			write_report("EXCEEDANCES", "\"FLIGHT\",\"PARAM\",\"ENG\",\"CYL\",\"START\",\"END\",\"SECS\",\"PEAK\",\"LIMIT\"\n",
+				exceedances);
+		}
+	}
+	catch (const fileabort&) {
+		bFailed = true;
+	}
+	if (opts.bStats) {
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - tStart;
+		stats.wallsecs = secs.count();
+		stats.report(*this, szName, opts.bStatsJson);
+	}
+}
+
+void datfile::translate_file(void)
+{
+	int fd = open_file();
+	struct _stat filestats;
+	if (_fstat(fd, &filestats) < 0) {
+		_close(fd);
+		fileerr("Unable to get file size %s", szCurrFile);
+	}
+	if ((filestats.st_mode & _S_IFMT) != _S_IFREG) {
+		if (opts.bCatalog)
+			fileerr("%s: --catalog needs a .DAT file, not a pipe", strcmp(szCurrFile, "-") ? szCurrFile : "(standard input)");
+
+		// pipes and the like get decoded as the bytes arrive
+		stream_file(fd);
+		return;
+	}
+	if (opts.bCatalog) {
+		catalog(fd, filestats.st_size);
+		return;
+	}
+	tModified = filestats.st_mtime;
+	{
+		phasetimer timer(pStats, PHASE_READ);
+		read_file(fd, filestats.st_size);
+	}
+	stats.nBytes = nFileBytes;
+	{
+		phasetimer timer(pStats, PHASE_HEADERS);
+		parse_headers();
+	}
+	if (opts.bRecalcChecksums)
+		recompute_checksums();
+	else
+#ifdef DBGOPTS
+		if (!opts.bNoFlights)
+#endif
+			parse_data();
+}
+
+
+//
+// --stats reports, a line or two of text for people, or a line of JSON for
+// anything watching the batches
+//
+
+void runstats::add(const runstats& s)
+{
+	for (unsigned i = 0; i < NUM_PHASES; i++)
+		secs[i] += s.secs[i];
+	wallsecs += s.wallsecs;
+	nBytes += s.nBytes;
+	nFlights += s.nFlights;
+	nRecords += s.nRecords;
+	nRepeats += s.nRepeats;
+	nRows += s.nRows;
+	nChecksumErrors += s.nChecksumErrors;
+	nFiles += s.nFiles;
+}
+
+// A quoted JSON string
+static std::string jsonstr(const char* s)
+{
+	std::string out = "\"";
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			out += '\\';
+			out += *s;
+		}
+		else if ((byte)*s < ' ') {
+			char buf[8];
+			sprintf(buf, "\\u%04x", (byte)*s);
+			out += buf;
+		}
+		else
+			out += *s;
+	}
+	return out + "\"";
+}
+
+// szFilename is NULL for the totals of the batch
+void runstats::report(msglog& out, const char* szFilename, bool bJson) const
+{
+	if (bJson) {
+		std::string line = "{";
+		if (szFilename)
+			line += "\"file\":" + jsonstr(szFilename) + ",";
+		else {
+			char buf[32];
+			sprintf(buf, "\"files\":%u,", nFiles);
+			line += buf;
+		}
+		char buf[512];
+		int n = sprintf(buf, "\"secs\":%.6f,\"bytes\":%llu,\"flights\":%llu,\"records\":%llu,\"repeats\":%llu,\"rows\":%llu,\"checksum_errors\":%llu",
+			wallsecs, (unsigned long long)nBytes, (unsigned long long)nFlights, (unsigned long long)nRecords,
+			(unsigned long long)nRepeats, (unsigned long long)nRows, (unsigned long long)nChecksumErrors);
+		for (unsigned i = 0; i < NUM_PHASES; i++)
+			n += sprintf(buf + n, ",\"%s_secs\":%.6f", s_phasenames[i], secs[i]);
+		line += buf;
+		out.print("%s}\n", line.c_str());
+		return;
+	}
+
+	if (szFilename)
+		out.print("Stats for %s:", szFilename);
+	else
+		out.print("Stats for %u files:", nFiles);
+	out.print(" %.3f ms, %llu bytes (%.1f MB/s), %llu flights, %llu records, %llu repeats, %llu rows, %llu checksum errors\n",
+		wallsecs * 1e3, (unsigned long long)nBytes, (wallsecs > 0) ? nBytes / wallsecs / 1e6 : 0.0,
+		(unsigned long long)nFlights, (unsigned long long)nRecords, (unsigned long long)nRepeats,
+		(unsigned long long)nRows, (unsigned long long)nChecksumErrors);
+	for (unsigned i = 0; i < NUM_PHASES; i++)
+		out.print("%s%s %.3f ms", i ? ", " : "  ", s_phasenames[i], secs[i] * 1e3);
+	out.print("\n");
+}
+
+
+//
+// File handling - the whole darn .DAT file is looked at in memory. It's
+// mapped read only when possible, so nothing gets copied and the OS can be
+// reading ahead while the flights are decoded. Anything that can't be mapped
+// is just read in.
+//
+// A file name of - is standard input, and that or anything else that isn't a
+// plain file (a pipe, say) is decoded as it's read instead; see stream_file().
+//
+
+int datfile::open_file(void)
+{
+	const char* szFilename = szCurrFile;
+	assert(strlen(szFilename));
+	if (strcmp(szFilename, "-") == 0) {
+		int fd = _fileno(stdin);
+		_setmode(fd, _O_BINARY);
+		return fd;
+	}
+	int fd = _open(szFilename, _O_BINARY | _O_RDONLY);
+	if (fd == -1)
+		fileerr("Unable to open file %s\n%s", szFilename, strerror(errno));
+	return fd;
+}
+
+// Takes care of closing fd
+void datfile::read_file(int fd, size_t nbytes)
+{
+	const char* szFilename = szCurrFile;
+	if (nbytes > 0 && map_file(fd, nbytes)) {
+		_close(fd);
+		return;
+	}
+
+	byte* pBytes;
+	if (!(pBytes = (byte*)malloc(nbytes))) {
+		_close(fd);
+		fileerr("Memory allocation failed (%d bytes)", nbytes);
+	}
+	pFileBytes = pBytes;
+	int nread = _read(fd, pBytes, (unsigned)nbytes);
+	_close(fd);
+	if (nread <= 0)
+		fileerr("Error reading file %s\n%s", szFilename, strerror(errno));
+	nFileBytes = nread;
+}
+
+bool datfile::map_file(int fd, size_t nbytes)
+{
+	void* pView;
+#ifdef _WIN32
+	HANDLE hMapping = CreateFileMapping((HANDLE)_get_osfhandle(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+		return false;
+	pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, nbytes);
+	CloseHandle(hMapping);							// the view keeps the mapping alive
+	if (pView == NULL)
+		return false;
+#else
+	pView = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (pView == MAP_FAILED)
+		return false;
+	// We go through it front to back, so have the OS start reading now
+	madvise(pView, nbytes, MADV_SEQUENTIAL);
+	madvise(pView, nbytes, MADV_WILLNEED);
+#endif
+	pFileBytes = (const byte*)pView;
+	nFileBytes = nbytes;
+	bMapped = true;
+	return true;
+}
+
+void datfile::unmap_file(void)
+{
+	if (bMapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(pFileBytes);
+#else
+		munmap((void*)pFileBytes, nFileBytes);
+#endif
+	}
+	else
+		free((void*)pFileBytes);
+	pFileBytes = NULL;
+	nFileBytes = 0;
+	bMapped = false;
+}
+
+void datfile::setdir(const char* basenam, char* outname, size_t outsize) const
+{
+	assert(basenam != NULL && outname != NULL && outsize >= _MAX_PATH);
+	char drive[_MAX_DRIVE];
+	char dir[_MAX_DIR];
+	char name[_MAX_FNAME];
+	char ext[_MAX_EXT];
+
+	_splitpath(szCurrFile, drive, dir, NULL, NULL);
+	_splitpath(basenam, NULL, NULL, name, ext);
+	_makepath(outname, drive, dir, name, ext);
+}
+
+void datfile::write_file(const char* szFilename, const void* bytes, size_t nbytes)
+{
+	assert(szFilename != NULL && strlen(szFilename));
+	assert(bytes != NULL && nbytes > 0);
+	int fd = _open(szFilename, _O_BINARY | _O_CREAT | _O_WRONLY | _O_TRUNC, _S_IWRITE);
+	if (fd == -1)
+		fileerr("Unable to open output file %s\n%s", szFilename, strerror(errno));
+	if (_write(fd, bytes, (unsigned)nbytes) != nbytes) {
+		_close(fd);
+		fileerr("Error writing file %s\n%s", szFilename, strerror(errno));
+	}
+	_close(fd);
+}
+
+// Write nbytes at nOffset in the file, leaving the rest of it alone
+static bool writeat(int fd, size_t nOffset, const void* bytes, size_t nbytes)
+{
+#ifdef _WIN32
+	if (_lseeki64(fd, nOffset, SEEK_SET) != (__int64)nOffset)
+		return false;
+	return _write(fd, bytes, (unsigned)nbytes) == (int)nbytes;
+#else
+	return pwrite(fd, bytes, nbytes, nOffset) == (ssize_t)nbytes;
+#endif
+}
+
+// Read up to nbytes at nOffset in the file, returning how many were read
+static int readat(int fd, size_t nOffset, void* bytes, size_t nbytes)
+{
+#ifdef _WIN32
+	if (_lseeki64(fd, nOffset, SEEK_SET) != (__int64)nOffset)
+		return -1;
+	return _read(fd, bytes, (unsigned)nbytes);
+#else
+	return (int)pread(fd, bytes, nbytes, nOffset);
+#endif
+}
+
+// Make szTo a copy of the file being worked on. Where the file system can
+// have the two share the same data (a reflink clone), nothing gets copied.
+void datfile::copy_file(const char* szTo)
+{
+#ifdef _WIN32
+	// CopyFile clones by itself on file systems that can (ReFS, Dev Drives)
+	if (CopyFileA(szCurrFile, szTo, FALSE))
+		return;
+#elif defined(__linux__)
+	int fdFrom = _open(szCurrFile, _O_BINARY | _O_RDONLY);
+	if (fdFrom != -1) {
+		int fdTo = _open(szTo, _O_BINARY | _O_CREAT | _O_WRONLY | _O_TRUNC, _S_IREAD | _S_IWRITE);
+		if (fdTo != -1) {
+			bool bCopied = ioctl(fdTo, FICLONE, fdFrom) == 0;
+			if (!bCopied) {
+				// otherwise have the kernel copy it, which still might share the data
+				size_t nLeft = nFileBytes;
+				ssize_t n = 0;
+				while (nLeft > 0 && (n = copy_file_range(fdFrom, NULL, fdTo, NULL, nLeft, 0)) > 0)
+					nLeft -= n;
+				bCopied = nLeft == 0;
+			}
+			_close(fdTo);
+			_close(fdFrom);
+			if (bCopied)
+				return;
+		}
+		else
+			_close(fdFrom);
+	}
+#endif
+	// and failing all that, write out the copy that's in memory
+	write_file(szTo, pFileBytes, nFileBytes);
+}
+
+// Write the file under a new name, with the patches made to it. Only the
+// parts of the file that change are written over the copy, a run of nearby
+// patches at a time.
+void datfile::write_patched_file(const char* szSuffix, const char* szExt, const std::vector<std::vector<patch> >& patches)
+{
+	char drive[_MAX_DRIVE];
+	char dir[_MAX_DIR];
+	char name[_MAX_FNAME];
+	char ext[_MAX_EXT];
+	char newpath[_MAX_PATH];
+	_splitpath(szCurrFile, drive, dir, name, ext);
+	strcat(name, szSuffix);
+	if (szExt == NULL)
+		szExt = ext;
+	_makepath(newpath, drive, dir, name, szExt);
+
+	copy_file(newpath);
+
+	int fd = _open(newpath, _O_BINARY | _O_WRONLY);
+	if (fd == -1)
+		fileerr("Unable to open output file %s\n%s", newpath, strerror(errno));
+
+	// Patches closer together than this go out in one write, since the file
+	// system has to rewrite the whole block around a byte anyway. The patches
+	// are in the order they are in the file.
+	static const size_t RUN_GAP = 4096;
+	std::vector<byte> run;
+	size_t nRunStart = 0;
+	for (size_t i = 0; i < patches.size(); i++) {
+		for (size_t j = 0; j < patches[i].size(); j++) {
+			const patch& pt = patches[i][j];
+			size_t nRunEnd = nRunStart + run.size();
+			if (!run.empty() && pt.nOffset >= nRunEnd + RUN_GAP) {
+				if (!writeat(fd, nRunStart, run.data(), run.size())) {
+					_close(fd);
+					fileerr("Error writing file %s\n%s", newpath, strerror(errno));
+				}
+				run.clear();
+			}
+			if (run.empty())
+				nRunStart = nRunEnd = pt.nOffset;
+			assert(pt.nOffset >= nRunStart);
+
+			// take in the bytes up to this one, then change it
+			if (pt.nOffset >= nRunEnd)
+				run.insert(run.end(), pFileBytes + nRunEnd, pFileBytes + pt.nOffset + 1);
+			run[pt.nOffset - nRunStart] = pt.b;
+		}
+	}
+	if (!run.empty() && !writeat(fd, nRunStart, run.data(), run.size())) {
+		_close(fd);
+		fileerr("Error writing file %s\n%s", newpath, strerror(errno));
+	}
+	_close(fd);
+}
+
+
+
+
+// Parse one header record (see jpi_parse_header()). The line is a terminated
+// copy (without the CR/LF) of the nLine bytes found at nOffset in the file.
+// Returns true for the $L record, which is the last one.
+bool datfile::parse_header(char* linebuf, size_t nLine, size_t nOffset)
+{
+	bool bLast;
+	jpistatus st = jpi_parse_header(*this, linebuf, nLine, nOffset, &bLast);
+	if (st != JPI_OK && st != JPI_UNKNOWN_RECORD)
+		fileerr("%s:\n --> %s", jpi_strerror(st), linebuf);
+
+	// maybe print the line
+#ifdef DBGOPTS
+	if (opts.bDisplayHeaders)
+		print("%s\n", linebuf);
+#endif
+	if (st == JPI_UNKNOWN_RECORD)
+		print("Unrecognized header record:\n --> %s\n", linebuf);
+	return bLast;
+}
+
+void datfile::parse_headers(void)
+{
+	const byte* pEnd = pFileBytes + nFileBytes;
+	const byte* pLine;
+	const byte* lf;
+	char linebuf[256];								// header records are short
+
+	for (pLine = pFileBytes; pLine < pEnd && (lf = (const byte*)memchr(pLine, '\r', pEnd - pLine)); pLine = lf) {
+		if (lf + 1 >= pEnd)
+			break;
+		assert(*lf == '\r' && *(lf + 1) == '\n');
+
+		// work on a terminated copy of the line
+		size_t nLine = lf - pLine;
+		if (nLine >= sizeof(linebuf))
+			fileerr("Header record too long at offset %u", (unsigned)(pLine - pFileBytes));
+		memcpy(linebuf, pLine, nLine);
+		linebuf[nLine] = 0;
+
+		lf += 2;											// point to next record
+
+		if (parse_header(linebuf, nLine, pLine - pFileBytes)) {
+			// Save end of headers for other funcs
+			pHeaderEnd = lf;
+			nDataOffset = lf - pFileBytes;
+
+			// NOTE: Normal exit path of function!
+			return;
+		}
+	}
+
+	// Note that this is not the typical exit path of the function, we SHOULD
+	// find the 'L' record and return from there. This is the error exit path.
+	fileerr("Unexpected end of .DAT file");
+}
+
+static void decode_datebits(ushort dt, ushort* m, ushort* d, ushort* y)
 {
 	assert(m && d && y);
 	// Date is coded into 16 bits as follows
@@ -769,13 +2063,37 @@ static void decode_timebits(ushort tm, ushort* h, ushort* m, ushort* s)
 
 
 // time helpers
+
+// localtime() is only thread safe in some C runtimes, so files being
+// translated at the same time use this instead
+static void localtm(time_t t, struct tm* ptm)
+{
+#ifdef _WIN32
+	localtime_s(ptm, &t);
+#else
+	localtime_r(&t, ptm);
+#endif
+}
+
+// Seconds into the local day
+static long localsecs(time_t t)
+{
+	struct tm tmbuf;
+	localtm(t, &tmbuf);
+	return tmbuf.tm_hour * 60L * 60 + tmbuf.tm_min * 60 + tmbuf.tm_sec;
+}
+
+#ifdef DBGOPTS
+// A localtime() call for the row, which rowclock is checked against
 static void cvttime(time_t t, ushort& hh, ushort& mm, ushort& ss)
 {
-	struct tm* tmptr = localtime(&t);
-	hh = tmptr->tm_hour;
-	mm = tmptr->tm_min;
-	ss = tmptr->tm_sec;
+	struct tm tmbuf;
+	localtm(t, &tmbuf);
+	hh = tmbuf.tm_hour;
+	mm = tmbuf.tm_min;
+	ss = tmbuf.tm_sec;
 }
+#endif // DBGOPTS
 
 static time_t inittime(ushort m, ushort d, ushort y, ushort hh, ushort mm, ushort ss)
 {
@@ -802,55 +2120,206 @@ static time_t inittime(ushort dtbits, ushort tmbits)
 }
 
 
-//
-// Format the data record into the format of the .CSV output
-//
-static void formatdata(time_t t, const datarec& rec, char* outbuf, size_t outsize)
+// For -u the recorded times are written as they are, with no time zone, and
+// dates are worked out directly (as if the times were UTC), without mktime()
+// and localtime() and the time zone setting.
+
+static const long SECS_PER_DAY = 24 * 60 * 60;
+
+// Days since 1/1/1970 (see http://howardhinnant.github.io/date_algorithms.html)
+static long daysfromcivil(int y, unsigned m, unsigned d)
 {
-	assert(outbuf != NULL && outsize > 0);
+	y -= m <= 2;
+	long era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);							// [0, 399]
+	unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;	// [0, 365]
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;				// [0, 146096]
+	return era * 146097 + (long)doe - 719468;
+}
 
-	// start printing the CSV line
-	size_t nout = 0;
-	ushort hh, mm, ss;
+// ...and back again
+static void civilfromdays(long z, ushort& y, ushort& m, ushort& d)
+{
+	z += 719468;
+	long era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned doe = (unsigned)(z - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = (ushort)(yoe + era * 400 + (m <= 2));
+}
+
+static time_t inittime_utc(ushort dtbits, ushort tmbits)
+{
+	ushort m, d, y, hh, mm, ss;
+	decode_datebits(dtbits, &m, &d, &y);
+	decode_timebits(tmbits, &hh, &mm, &ss);
+	assert(1 <= m && m <= 12);						// input not zero based
+	int yr = (y < 50) ? y + 2000 : y + 1900;	// same century issue as inittime()
+	return (time_t)daysfromcivil(yr, m, d) * SECS_PER_DAY + hh * 60 * 60 + mm * 60 + ss;
+}
 
-	cvttime(t, hh, mm, ss);
-	nout += sprintf(outbuf + nout, "\"%d:%d:%d\"", hh, mm, ss);
+#ifdef DBGOPTS
+static void gmtm(time_t t, struct tm* ptm)
+{
+#ifdef _WIN32
+	gmtime_s(ptm, &t);
+#else
+	gmtime_r(&t, ptm);
+#endif
+}
+#endif // DBGOPTS
 
-	for (unsigned j = 0; j < NUMENGINE(); j++) {
 
-		// loop through each field except "MARK" (the last field)
-		for (unsigned i = 0; i < countof(fielddesc) - 1; i++) {
-			if (!fielddesc[i].bPerEngine && j < NUMENGINE() - 1)
-				continue;
-			if (fielddesc[i].nWhichEng && !(fielddesc[i].nWhichEng & (1 << j)))
-				continue;
-			// making the & logic equal the flags allows some of the combined flags to work (e.g. HP)
-			if ((fielddesc[i].nFeatureFlag & config.flags) == fielddesc[i].nFeatureFlag) {
-				int offset = fielddesc[i].nOffset;
-				// yet another special case hack to cover the computed DIF field
-				if (offset < 0)
-					nout += sprintf(outbuf + nout, ",%d", rec.dif[j]);
-				else {
-					if (fielddesc[i].bPerEngine)
-						offset += j * TWINJUMP;
-					if (!testbit(rec.naflags, offset)) {
-						short s = rec.sarray[offset];
-						nout += sprintf(outbuf + nout, ",%d", s / fielddesc[i].nScale);
-						if (s % fielddesc[i].nScale)
-							nout += sprintf(outbuf + nout, ".%d", s % fielddesc[i].nScale);
-					}
+void rowclock::get(time_t t, ushort& h, ushort& m, ushort& s)
+{
+	if (t < tBase || t >= tNext) {
+		if (bUTC) {
+			long days = (long)(t / SECS_PER_DAY);
+			if (t % SECS_PER_DAY < 0)
+				days--;
+			tBase = (time_t)days * SECS_PER_DAY;
+			tNext = tBase + SECS_PER_DAY;
+			civilfromdays(days, yr, mon, day);
+			hh = 0;
+		}
+		else {
+			struct tm tmbuf;
+			localtm(t, &tmbuf);
+			tBase = t - (tmbuf.tm_min * 60 + tmbuf.tm_sec);
+			tNext = tBase + 60 * 60;
+			hh = tmbuf.tm_hour;
+
+			// If the UTC offset changes before the hour is up, find the second
+			// it does so the counting stops there
+			long nBaseSecs = hh * 60L * 60;
+			if (localsecs(tNext - 1) != nBaseSecs + 60 * 60 - 1) {
+				time_t tOk = t, tChanged = tNext - 1;
+				while (tChanged - tOk > 1) {
+					time_t tMid = tOk + (tChanged - tOk) / 2;
+					if (localsecs(tMid) == nBaseSecs + (long)(tMid - tBase))
+						tOk = tMid;
 					else
-						nout += sprintf(outbuf + nout, ",\"NA\"");
+						tChanged = tMid;
 				}
+				tNext = tChanged;
+			}
+		}
+	}
+	unsigned nSecs = (unsigned)(t - tBase);
+	h = hh + nSecs / (60 * 60);
+	m = nSecs / 60 % 60;
+	s = nSecs % 60;
+}
+
+
+void flightctx::plancolumns(void)
+{
+	// A --summary has the same columns for every flight, the ones in the $C record
+	nColumns = jpi_plancolumns(columns, file.numengine(), opts.bSummary ? file.config.flags : fhead.flags, opts.bColumns ? opts.columnmask : NULL);
+	// ...and a column the flight doesn't have stays NA, rather than being the
+	// value data records start with
+	if (opts.bSummary) {
+		column flightcols[MAX_COLUMNS];
+		unsigned nFlightCols = jpi_plancolumns(flightcols, file.numengine(), fhead.flags, NULL);
+		for (unsigned i = 0; i < nColumns; i++) {
+			summary.nLimits[i] = limitof(columns[i].szName);
+			summary.bInFlight[i] = false;
+			for (unsigned j = 0; j < nFlightCols; j++) {
+				if (flightcols[j].nOffset == columns[i].nOffset)
+					summary.bInFlight[i] = true;
 			}
 		}
 	}
 
-	// "MARK" field special case since it's output as a string not a numeric value
-	nout += sprintf(outbuf + nout, ",%s\n", rec.mark ? "\"S\"" : "");
+	// --where can look at any of the flight's columns, not just those written
+	if (opts.pWhere) {
+		column all[MAX_COLUMNS];
+		unsigned nAll = jpi_plancolumns(all, file.numengine(), fhead.flags, NULL);
+		where.compile(*opts.pWhere, all, nAll);
+	}
+}
+
+//
+// Format the current data record into the format of the .CSV output, with
+// jpi_csvline() (see jpiformat.h). Debug builds check every row against
+// formatdata_printf(), which is the same thing done the easy way.
+//
+const char* flightctx::formatdata(void)
+{
+	if (bValuesCurrent)
+		nCachedRows++;
+	nRows++;
+
+	char timebuf[JPI_MAX_TIME_FIELD];
+	size_t ntime = formattime(timebuf, t) - timebuf;
+	const char* line = jpi_csvline(rowbuf, sizeof(rowbuf), !bValuesCurrent, columns, nColumns, rec, timebuf, ntime);
+	bValuesCurrent = true;
+
+#ifdef DBGOPTS
+	char check[512];
+	formatdata_printf(check, sizeof(check));
+	if (strcmp(check, line))
+		fileerr("CSV formatting doesn't match sprintf():\n%s%s", check, line);
+#endif
+	return line;
+}
+
+char* flightctx::formattime(char* p, time_t tRow)
+{
+	ushort hh, mm, ss;
+
+	rowtime.get(tRow, hh, mm, ss);
+	*p++ = '"';
+	if (opts.bUTC) {
+		// ISO-8601
+		p = putint(p, rowtime.yr);
+		*p++ = '-';
+		p = put2(p, rowtime.mon);
+		*p++ = '-';
+		p = put2(p, rowtime.day);
+		*p++ = 'T';
+		p = put2(p, hh);
+		*p++ = ':';
+		p = put2(p, mm);
+		*p++ = ':';
+		p = put2(p, ss);
+	}
+	else {
+		p = putint(p, hh);
+		*p++ = ':';
+		p = putint(p, mm);
+		*p++ = ':';
+		p = putint(p, ss);
+	}
+	*p++ = '"';
+	return p;
+}
+
+#ifdef DBGOPTS
+void flightctx::formatdata_printf(char* outbuf, size_t outsize) const
+{
+	assert(outbuf != NULL && outsize > 0);
+
+	// start printing the CSV line
+	size_t nout = 0;
+	ushort hh, mm, ss;
+
+	if (opts.bUTC) {
+		struct tm tmbuf;
+		gmtm(t, &tmbuf);
+		nout += strftime(outbuf + nout, outsize - nout, "\"%Y-%m-%dT%H:%M:%S\"", &tmbuf);
+	}
+	else {
+		cvttime(t, hh, mm, ss);
+		nout += sprintf(outbuf + nout, "\"%d:%d:%d\"", hh, mm, ss);
+	}
 
-	assert(nout < outsize);
+	jpi_formatvalues_printf(outbuf + nout, outsize - nout, columns, nColumns, rec);
 }
+#endif // DBGOPTS
 
 
 //
@@ -862,94 +2331,191 @@ static void formatdata(time_t t, const datarec& rec, char* outbuf, size_t outsiz
 // of data to track down those last unrecognized bits.
 //
 
-#ifdef DBGOPTS
-static FILE* s_fCompareCSV;
-#endif
-static FILE* s_fOutputCSV;
+// In batch mode different .DAT files in the same directory can hold the same
+// flight, so each CSV file is written under a temp name and renamed into
+// place when it's done. When files collide, the one named last on the
+// command line wins, just as it would translating them one after another.
+static std::mutex s_outputlock;
+static std::map<std::string, unsigned> s_outputowner;	// CSV path -> nJob that wrote it
 
-static void opencsv(ushort flightnum)
+void flightctx::opencsv(ushort flightnum)
 {
 	char fnam[_MAX_FNAME];
 	char path[_MAX_PATH];
 
-	sprintf(fnam, "F%05d%s.CSV", flightnum, (s_bSuppressSuffix) ? "" : "-HACK");
-	setdir(fnam, path, sizeof(path));
-	if (!(s_fOutputCSV = fopen(path, "w")))
-		errexit("Unable to open output file %s:\n%s", path, strerror(errno));
+	sprintf(fnam, "F%05d%s.%s", flightnum, (opts.bSuppressSuffix) ? "" : "-HACK", (opts.bArrow) ? "arrow" : "CSV");
+	file.setdir(fnam, path, sizeof(path));
+	if (s_nJobs > 1) {
+		strcpy(szOutputCSV, path);
+		if ((size_t)snprintf(szTempCSV, sizeof(szTempCSV), "%s.%u~", path, file.nJob) >= sizeof(szTempCSV))
+			fileerr("Output file name too long: %s", path);
+		strcpy(path, szTempCSV);
+	}
+	if (!OutputCSV.open(path, !opts.bArrow))
+		fileerr("Unable to open output file %s:\n%s", path, strerror(errno));
 
 #ifdef DBGOPTS
-	if (!s_bCompareCSV)
+	if (!opts.bCompareCSV)
 		return;
 
 	sprintf(fnam, "F%05d.CSV", flightnum);
-	setdir(fnam, path, sizeof(path));
-	if (!(s_fCompareCSV = fopen(path, "r")))
-		errexit("Unable to open comparison file %s:\n%s", path, strerror(errno));
+	file.setdir(fnam, path, sizeof(path));
+	if (!(fCompareCSV = fopen(path, "r")))
+		fileerr("Unable to open comparison file %s:\n%s", path, strerror(errno));
 #endif // DBGOPTS
 }
 
-static void closecsv(void)
+// bKeep is false when giving up on the file, which throws away a temp file
+void flightctx::closecsv(bool bKeep)
 {
-	if (s_fOutputCSV) {
-		fclose(s_fOutputCSV);
-		s_fOutputCSV = NULL;
+	if (OutputCSV.isopen()) {
+		int err;
+		{
+			phasetimer timer(bKeep ? pStats : NULL, PHASE_WRITE);
+			err = OutputCSV.close();
+		}
+		if (err && bKeep) {
+			print("Error writing output file.\n%s\n", strerror(err));
+			bFailed = true;
+			bKeep = false;
+		}
+		if (szTempCSV[0]) {
+			std::lock_guard<std::mutex> held(s_outputlock);
+			std::map<std::string, unsigned>::iterator owner = s_outputowner.find(szOutputCSV);
+			if (bKeep && (owner == s_outputowner.end() || owner->second <= file.nJob)) {
+				s_outputowner[szOutputCSV] = file.nJob;
+				remove(szOutputCSV);
+				if (rename(szTempCSV, szOutputCSV) != 0)
+					print("Unable to rename %s to %s:\n%s\n", szTempCSV, szOutputCSV, strerror(errno));
+			}
+			else
+				remove(szTempCSV);
+			szOutputCSV[0] = szTempCSV[0] = 0;
+		}
 	}
 #ifdef DBGOPTS
-	if (s_fCompareCSV) {
-		fclose(s_fCompareCSV);
-		s_fCompareCSV = NULL;
+	if (fCompareCSV) {
+		fclose(fCompareCSV);
+		fCompareCSV = NULL;
 	}
 #endif
 }
 
-static void outputline(const char* line, bool bsuppressdiff = false)
+void flightctx::outputline(const char* line, bool bsuppressdiff)
 {
 	assert(line != NULL);
 
-	if (s_fOutputCSV)
-		if (fputs(line, s_fOutputCSV) == EOF)
-			errexit("Error writing output file.\n%s", strerror(errno));
+	if (OutputCSV.isopen()) {
+		phasetimer timer(pStats, PHASE_WRITE);
+		OutputCSV.write(line, strlen(line));
+		if (OutputCSV.error())
+			fileerr("Error writing output file.\n%s", strerror(OutputCSV.error()));
+	}
 
 #ifdef DBGOPTS
 	const char* prefix = "";
-	if (s_bCompareCSV) {
-		if (!s_fCompareCSV)
-			errexit("Comparison file not opened correctly (??)");
+	if (opts.bCompareCSV) {
+		if (!fCompareCSV)
+			fileerr("Comparison file not opened correctly (??)");
 
 		char buf[512] = { 0 };
-		if (!fgets(buf, sizeof(buf), s_fCompareCSV))
-			errexit("Unexpected end of comparison file");
+		if (!fgets(buf, sizeof(buf), fCompareCSV))
+			fileerr("Unexpected end of comparison file");
 
 		if (strcmp(buf, line) && !bsuppressdiff) {
 			prefix = "!";
-			printf("%s%s", prefix, buf);
-			printf("%s%s", prefix, line);
+			print("%s%s", prefix, buf);
+			print("%s%s", prefix, line);
 			return;
 		}
 	}
 
-	if (s_bDebugDetail)
-		printf("%s%s", prefix, line);
+	if (opts.bDebugDetail)
+		print("%s%s", prefix, line);
 #endif
 }
 
+// Output the row for time t, unless -t or --where leaves it out, and move on
+// to the next
+void flightctx::nextrow(void)
+{
+	if (opts.bWindow) {
+		if (t < tFrom || t >= tTo) {
+			if (opts.bExceedances)
+				gaplimits();
+			t += fhead.interval_secs;
+			return;
+		}
+		if (nRows == 0)
+			tFirstRow = t;
+		tLastRow = t;
+	}
+	if (opts.pWhere) {
+		// the rows a record's repeat count adds have the same answer
+		if (!bWhereCurrent) {
+			bWhereMatch = where.test(rec);
+			bWhereCurrent = true;
+		}
+		if (!bWhereMatch) {
+			if (opts.bExceedances)
+				gaplimits();
+			t += fhead.interval_secs;
+			return;
+		}
+	}
+	outputrow();
+	t += fhead.interval_secs;
+}
+
+void flightctx::outputrow(void)
+{
+	stats.nRows++;
+	if (opts.bSummary || opts.bExceedances) {
+		// Neither writes the row, they just take it in
+		if (opts.bSummary)
+			addsummary();
+		if (opts.bExceedances)
+			checklimits();
+		bValuesCurrent = true;
+		nRows++;
+	}
+	else if (pArrow) {
+		{
+			phasetimer timer(pStats, PHASE_FORMAT);
+			pArrow->addrow(t, rec);
+		}
+		nRows++;
+		if (OutputCSV.error())
+			fileerr("Error writing output file.\n%s", strerror(OutputCSV.error()));
+	}
+	else {
+		const char* line;
+		{
+			phasetimer timer(pStats, PHASE_FORMAT);
+			line = formatdata();
+		}
+		outputline(line);
+	}
+}
+
 // Minor hack - we go through and write all the data before we know how many hours
 // to put in the "Duration" line of the CSV file, so we just save where we were
-// in that file and then come back to it.
-static long s_DurationOffset;
+// in that file (DurationOffset) and then come back to it.
 
-static void outputheaders(const flightheader& fhead)
+void flightctx::outputheaders(const flightheader& fhead)
 {
 	time_t t = time(NULL);
-	struct tm* tp = localtime(&t);
+	struct tm tmbuf;
+	struct tm* tp = &tmbuf;
+	localtm(t, tp);
 	char outbuf[512];
 	int nout;
 
 	sprintf(outbuf, "\"EZSave     %02d/%02d/%02d\"\n", tp->tm_mon + 1, tp->tm_mday, tp->tm_year % 100);
 	outputline(outbuf, true); // ignore diffs in this line - they won't ever match
-	sprintf(outbuf, "\"EDM-%4d V %3d J.P.Instruments  (C) 1998\"\n", config.model, config.firmware_version);
+	sprintf(outbuf, "\"EDM-%4d V %3d J.P.Instruments  (C) 1998\"\n", file.config.model, file.config.firmware_version);
 	outputline(outbuf);
-	sprintf(outbuf, "\"Aircraft Number %s\"\n", tailnum);
+	sprintf(outbuf, "\"Aircraft Number %s\"\n", file.tailnum);
 	outputline(outbuf);
 
 	ushort y, m, d;
@@ -972,94 +2538,418 @@ static void outputheaders(const flightheader& fhead)
 	outputline(outbuf);
 
 	// See note above about fixing the Duration later.
-	s_DurationOffset = ftell(s_fOutputCSV); // update duration after all data is read
+	DurationOffset = OutputCSV.tell(); // update duration after all data is read
 	sprintf(outbuf, "\"Duration  0.00Hours   Interval %d seconds    \"\n", fhead.interval_secs);
 	outputline(outbuf, true); // ignore diffs in this line - they won't match 'til later
 
 	// write the CSV field titles
 	nout = sprintf(outbuf, "\"TIME\"");
-	for (unsigned j = 0; j < NUMENGINE(); j++) {
-		for (unsigned i = 0; i < countof(fielddesc); i++) {
-			const char* eng;
-			if (!fielddesc[i].bPerEngine || NUMENGINE() == 1)
-				eng = "";
-			else if (j > 0)
-				eng = "R";
-			else
-				eng = "L";
-			if ((fielddesc[i].nFeatureFlag & fhead.flags) == fielddesc[i].nFeatureFlag &&
-				(fielddesc[i].bPerEngine || j == NUMENGINE() - 1) &&
-				(!fielddesc[i].nWhichEng || (fielddesc[i].nWhichEng & (1 << j))))
-				nout += sprintf(outbuf + nout, ",\"%s%s\"", eng, fielddesc[i].szName);
-		}
-	}
+	for (unsigned i = 0; i < nColumns; i++)
+		nout += sprintf(outbuf + nout, ",\"%s%s\"", columns[i].szEng, columns[i].szName);
+	if ((fielddesc[MARK_FIELD].nFeatureFlag & fhead.flags) == fielddesc[MARK_FIELD].nFeatureFlag)
+		nout += sprintf(outbuf + nout, ",\"%s\"", fielddesc[MARK_FIELD].szName);
 	nout += sprintf(outbuf + nout, ",\n"); // EZSave appended an extra comma in the field names line...
 	outputline(outbuf);
 }
 
+// The Arrow file's columns are the CSV file's, and what the CSV headers say
+// about the flight goes in the schema metadata
+void flightctx::outputschema(const flightheader& fhead)
+{
+	char buf[32];
+
+	pArrow.reset(new arrowwriter(OutputCSV, columns, nColumns));
+	pArrow->addmeta("aircraft", file.tailnum);
+	sprintf(buf, "EDM-%d", file.config.model);
+	pArrow->addmeta("model", buf);
+	sprintf(buf, "%d", file.config.firmware_version);
+	pArrow->addmeta("firmware_version", buf);
+	sprintf(buf, "%d", fhead.flightnum);
+	pArrow->addmeta("flight", buf);
+	sprintf(buf, "%d", fhead.interval_secs);
+	pArrow->addmeta("interval_secs", buf);
+	pArrow->addmeta("oat_units", (fhead.unknown_value & 0x20) ? "F" : "C");	// see outputheaders()
+	pArrow->begin();
+	if (OutputCSV.error())
+		fileerr("Error writing output file.\n%s", strerror(OutputCSV.error()));
+}
+
 static const float SECS_PER_HOUR = (float)60.0 * (float)60.0;
-static void write_duration(time_t t, const flightheader& fhead)
+void flightctx::write_duration(time_t tFirst, time_t tLast)
+{
+	if (!OutputCSV.isopen() || DurationOffset < 0)			// can't go back if it's not a real file
+		return;
+
+	char buf[32];
+	int n = sprintf(buf, "\"Duration %5.2f", ((float)(tLast - tFirst)) / SECS_PER_HOUR);
+	OutputCSV.patch(DurationOffset, buf, n);
+}
+
+
+//
+// --summary (see flightsummary)
+//
+
+// Take the row at t into the summary
+void flightctx::addsummary(void)
+{
+	if (!bValuesCurrent) {
+		flushsummary();
+		summary.last = rec;
+	}
+	summary.nLastRows++;
+}
+
+// Add in the rows counted so far
+void flightctx::flushsummary(void)
+{
+	const datarec& last = summary.last;
+	ulong n = summary.nLastRows;
+	if (n == 0)
+		return;
+	bool bOver[NUM_LIMITS] = { false };
+	for (unsigned i = 0; i < nColumns; i++) {
+		const column& col = columns[i];
+		if (!summary.bInFlight[i] || (col.nNABit != NO_NABIT && testbit(last.naflags, col.nNABit)))
+			continue;
+		short s = last.sarray[col.nOffset];
+		flightsummary::range& r = summary.ranges[i];
+		if (r.nRows == 0 || s < r.nMin)
+			r.nMin = s;
+		if (r.nRows == 0 || s > r.nMax)
+			r.nMax = s;
+		r.nSum += (int64_t)s * n;
+		r.nRows += n;
+		ushort iLimit = summary.nLimits[i];
+		if (iLimit != NO_LIMIT) {
+			ushort nLimit = limitvalue(file.limits, iLimit);
+			if (nLimit && s > (int)nLimit * (int)col.nScale)
+				bOver[iLimit] = true;
+		}
+	}
+	for (unsigned i = 0; i < NUM_LIMITS; i++) {
+		if (bOver[i])
+			summary.nOverRows[i] += n;
+	}
+	summary.nLastRows = 0;
+}
+
+// The flight's line of the summary file, see datfile::write_summary()
+void flightctx::formatsummary(void)
+{
+	flushsummary();
+
+	ushort y, m, d;
+	ushort hh, mm, ss;
+	decode_datebits(fhead.dt, &m, &d, &y);
+	decode_timebits(fhead.tm, &hh, &mm, &ss);
+	ulong nSecs = nRows * fhead.interval_secs;
+
+	// Fuel flow is in tenths of a gallon an hour, so the gallons burned are its
+	// sum over the rows times the seconds each row is, over 36000
+	int64_t nFuel = 0;
+	for (unsigned i = 0; i < nColumns; i++) {
+		if (strcmp(columns[i].szName, "FF") == 0)
+			nFuel += summary.ranges[i].nSum;
+	}
+
+	char buf[256];
+	sprintf(buf, "%u,%d/%02d/%02d,%d:%02d:%02d,%u,%lu,%lu,%.1f", fhead.flightnum, m, d, y, hh, mm, ss,
+		fhead.interval_secs, nSecs, nRows, (double)nFuel * fhead.interval_secs / 36000);
+	summaryline = buf;
+	for (unsigned i = 0; i < NUM_LIMITS; i++) {
+		sprintf(buf, ",%lu", summary.nOverRows[i] * fhead.interval_secs);
+		summaryline += buf;
+	}
+
+	for (unsigned i = 0; i < nColumns; i++) {
+		const flightsummary::range& r = summary.ranges[i];
+		if (r.nRows == 0) {
+			summaryline += ",\"NA\",\"NA\",\"NA\"";
+			continue;
+		}
+		char* p = buf;
+		*p++ = ',';
+		p = putscaled(p, r.nMin, columns[i].nScale);
+		*p++ = ',';
+		p = putscaled(p, r.nMax, columns[i].nScale);
+		sprintf(p, ",%.*f", (columns[i].nScale == 1) ? 1 : 2, (double)r.nSum / r.nRows / columns[i].nScale);
+		summaryline += buf;
+	}
+	summaryline += "\n";
+}
+
+// A file of lines about the flights, named for the .DAT file with szSuffix
+// (R4-SUMMARY.CSV for R4.DAT, or just SUMMARY.CSV for standard input)
+void datfile::write_report(const char* szSuffix, const std::string& heading, const std::vector<std::string>& lines)
+{
+	char name[_MAX_FNAME];
+	char fnam[_MAX_FNAME + 32];
+	char path[_MAX_PATH];
+	if (strcmp(szCurrFile, "-") == 0)
+		sprintf(fnam, "%s.CSV", szSuffix);
+	else {
+		_splitpath(szCurrFile, NULL, NULL, name, NULL);
+		sprintf(fnam, "%s-%s.CSV", name, szSuffix);
+	}
+	setdir(fnam, path, sizeof(path));
+
+	FILE* f = fopen(path, "w");
+	if (!f)
+		fileerr("Unable to open output file %s:\n%s", path, strerror(errno));
+	fputs(heading.c_str(), f);
+	for (size_t i = 0; i < lines.size(); i++)
+		fputs(lines[i].c_str(), f);
+	if (fclose(f) != 0)
+		fileerr("Error writing file %s\n%s", path, strerror(errno));
+}
+
+// The summary file for --summary, with a line for each flight. Every line
+// has the columns of the $C record, with NA for any a flight didn't have.
+void datfile::write_summary(void)
+{
+	std::string heading = "\"FLIGHT\",\"DATE\",\"TIME\",\"INTERVAL\",\"SECS\",\"ROWS\",\"FUEL\"";
+	char buf[64];
+	for (unsigned i = 0; i < NUM_LIMITS; i++) {
+		sprintf(buf, ",\"%s OVER\"", s_limitnames[i]);
+		heading += buf;
+	}
+	column columns[MAX_COLUMNS];
+	unsigned nColumns = jpi_plancolumns(columns, numengine(), config.flags, opts.bColumns ? opts.columnmask : NULL);
+	for (unsigned i = 0; i < nColumns; i++) {
+		static const char* const stats[] = { "MIN", "MAX", "MEAN" };
+		for (unsigned j = 0; j < countof(stats); j++) {
+			sprintf(buf, ",\"%s%s %s\"", columns[i].szEng, columns[i].szName, stats[j]);
+			heading += buf;
+		}
+	}
+	heading += "\n";
+	write_report("SUMMARY", heading, summaries);
+}
+
+
+//
+// --exceedances (see flightlimits)
+//
+
+// Work out the checks for the flight's columns, leaving out any limit the
+// instrument doesn't have set
+void flightctx::planlimits(void)
+{
+	const limitsrec& lim = file.limits;
+	unsigned nCooling = 0;
+	limits.nCoolingRows = max(1u, COOLING_SECS / max((unsigned)fhead.interval_secs, 1u));
+
+	for (unsigned i = 0; i < nColumns; i++) {
+		const char* szName = columns[i].szName;
+		struct { const char* szParam; ushort nLimit; bool bLow; bool bCooling; } want[2];
+		unsigned nWant = 0;
+		if (szName[0] == 'C' && isdigit((byte)szName[1])) {
+			want[nWant++] = { "CHT", lim.cht, false, false };
+			want[nWant++] = { "COOLING", lim.cld, false, true };
+		}
+		else if (szName[0] == 'T' && isdigit((byte)szName[1]))
+			want[nWant++] = { "TIT", lim.tit, false, false };
+		else if (strcmp(szName, "DIF") == 0)
+			want[nWant++] = { "DIF", lim.dif, false, false };
+		else if (strcmp(szName, "OIL") == 0) {
+			want[nWant++] = { "OIL HI", lim.oilhi, false, false };
+			want[nWant++] = { "OIL LO", lim.oillo, true, false };
+		}
+		else if (strcmp(szName, "BAT") == 0) {
+			want[nWant++] = { "VOLTS HI", lim.voltshi, false, false };
+			want[nWant++] = { "VOLTS LO", lim.voltslo, true, false };
+		}
+		else if (strcmp(szName, "CLD") == 0)
+			want[nWant++] = { "CLD", lim.cld, true, false };		// it's negative when cooling
+
+		for (unsigned j = 0; j < nWant; j++) {
+			if (want[j].nLimit == 0 || want[j].nLimit > 0x7fff)
+				continue;
+			if (want[j].bCooling && nCooling >= MAX_COOLING)
+				continue;
+			assert(limits.nChecks < countof(limits.checks));
+			limitcheck& check = limits.checks[limits.nChecks++];
+			check.szParam = want[j].szParam;
+			check.iColumn = (ushort)i;
+			check.nLimit = (strcmp(szName, "CLD") == 0) ? -(short)want[j].nLimit : (short)want[j].nLimit;
+			check.bLow = want[j].bLow;
+			check.recent = want[j].bCooling ? limits.recent[nCooling++] : NULL;
+			check.bActive = false;
+			check.tFrom = 0;
+			check.nPeak = 0;
+		}
+	}
+}
+
+// Check the row at t. Until a new data record comes along the values are the
+// same, so only the cooling checks have anything new to look at - unless it's
+// the first row after a gap.
+void flightctx::checklimits(void)
+{
+	unsigned nRing = limits.nCoolingRows + 1;
+	for (unsigned i = 0; i < limits.nChecks; i++) {
+		limitcheck& check = limits.checks[i];
+		const column& col = columns[check.iColumn];
+		if (!check.recent && bValuesCurrent && limits.nRows > 0)
+			continue;
+
+		short s = rec.sarray[col.nOffset];
+		bool bNA = col.nNABit != NO_NABIT && testbit(rec.naflags, col.nNABit);
+		if (check.recent) {
+			// Degrees a minute, from the CHT nCoolingRows back
+			check.recent[limits.nRows % nRing] = bNA ? NA_VALUE : s;
+			short nBack = (limits.nRows >= limits.nCoolingRows) ? check.recent[(limits.nRows - limits.nCoolingRows) % nRing] : NA_VALUE;
+			bNA = bNA || nBack == NA_VALUE;
+			if (!bNA)
+				s = (short)((nBack - s) * 60 / (int)(limits.nCoolingRows * fhead.interval_secs));
+		}
+		if (bNA) {
+			// a value that's missing ends the event
+			if (check.bActive)
+				endevent(check, t - fhead.interval_secs);
+		}
+		else
+			checklimit(check, s);
+	}
+	limits.nRows++;
+	limits.tLast = t;
+}
+
+// The row at t is left out. If it follows a row that was checked, end the
+// events going on there and start the cooling checks over.
+void flightctx::gaplimits(void)
+{
+	if (limits.nRows == 0)
+		return;
+	for (unsigned i = 0; i < limits.nChecks; i++) {
+		if (limits.checks[i].bActive)
+			endevent(limits.checks[i], limits.tLast);
+	}
+	limits.nRows = 0;
+}
+
+void flightctx::checklimit(limitcheck& check, short s)
 {
-	if (!s_fOutputCSV)
+	bool bOver = check.bLow ? s < check.nLimit : s > check.nLimit;
+	if (!bOver) {
+		if (check.bActive)
+			endevent(check, t - fhead.interval_secs);
 		return;
+	}
+	if (!check.bActive) {
+		check.bActive = true;
+		check.tFrom = t;
+		check.nPeak = s;
+	}
+	else if (check.bLow ? s < check.nPeak : s > check.nPeak)
+		check.nPeak = s;
+}
 
-	time_t start = inittime(fhead.dt, fhead.tm);
-	fseek(s_fOutputCSV, s_DurationOffset, SEEK_SET);
-	fprintf(s_fOutputCSV, "\"Duration %5.2f", ((float)(t - start)) / SECS_PER_HOUR);
+// Add the event to the flight's lines, as having lasted until the row at tLast
+void flightctx::endevent(limitcheck& check, time_t tLast)
+{
+	const column& col = columns[check.iColumn];
+	const char* pCyl = col.szName;
+	while (*pCyl && !isdigit((byte)*pCyl))
+		pCyl++;
+	unsigned nScale = check.recent ? 1 : col.nScale;	// cooling's in whole degrees a minute
+
+	char buf[256];
+	char* p = buf + sprintf(buf, "%u,\"%s\",\"%s\",%s,", fhead.flightnum, check.szParam, col.szEng, pCyl);
+	p = formattime(p, check.tFrom);
+	*p++ = ',';
+	p = formattime(p, tLast);
+	p += sprintf(p, ",%lu,", (ulong)(tLast - check.tFrom) + fhead.interval_secs);
+	p = putscaled(p, check.nPeak, nScale);
+	*p++ = ',';
+	p = putscaled(p, check.nLimit, nScale);
+	*p++ = '\n';
+	*p = 0;
+	limits.events += buf;
+	check.bActive = false;
 }
 
 
 #ifdef DBGOPTS
 // This routine is just for dumping bits/bytes if you're scratching your head
 // over the contents of the .DAT file.
-static void dumpflightheader(const flightheader& fhead)
+void flightctx::dumpflightheader(const flightheader& fhead)
 {
 	ushort y, m, d;
 	ushort hh, mm, ss;
 	decode_datebits(fhead.dt, &m, &d, &y);
 	decode_timebits(fhead.tm, &hh, &mm, &ss);
-	printf("FltHdr: #%5u, flgs 0x%08x, unk %02x, secs %d, %2d/%02d/%02d %2d:%02d:%02d\n", fhead.flightnum, fhead.flags, fhead.unknown_value, fhead.interval_secs, m, d, y, hh, mm, ss);
+	print("FltHdr: #%5u, flgs 0x%08x, unk %02x, secs %d, %2d/%02d/%02d %2d:%02d:%02d\n", fhead.flightnum, fhead.flags, fhead.unknown_value, fhead.interval_secs, m, d, y, hh, mm, ss);
 }
 #endif // DBGOPTS
 
 
 //
-// Checksum the various data records
-//
-// NOTE: This is the only change between the "new" .DAT files
-// and the "old" .DAT files, i.e. they changed the XOR based
-// checksum to the SUM based checksum in firmware versions after 3.00.
+// --catalog lists the flights in a file from its header records and each
+// flight's header, without reading the flight data in between. For a file
+// of several MB that's a few reads of a few KB each, so a whole archive of
+// them can be gone through quickly.
 //
 
-static byte calc_new_checksum(const void* pBytes, size_t nbytes)
-{
-	assert(pBytes && nbytes > 0);
-	byte cksum = 0;
-	const byte* p = reinterpret_cast<const byte*>(pBytes);
-	while (nbytes-- > 0)
-		cksum += *p++;
-	cksum = -cksum;
-	return cksum;
-}
+static const char CATALOG_HEADING[] = "TAIL       MODEL    FW  FLIGHT  DATE     TIME      SECS     BYTES  FILE\n";
 
-static byte calc_old_checksum(const void* pBytes, size_t nbytes)
+// Takes care of closing fd
+void datfile::catalog(int fd, size_t nbytes)
 {
-	assert(pBytes && nbytes > 0);
-	byte cksum = 0;
-	const byte* p = reinterpret_cast<const byte*>(pBytes);
-	while (nbytes-- > 0)
-		cksum ^= *p++;
-	return cksum;
-}
+	// The headers are a few KB, but there can be hundreds of $D records
+	std::vector<byte> head;
+	size_t nWant = 4096;
+	jpistatus st;
+	for (;;) {
+		head.resize(min(nWant, nbytes));
+		int nread = readat(fd, 0, head.data(), head.size());
+		if (nread < 0) {
+			_close(fd);
+			fileerr("Error reading file %s\n%s", szCurrFile, strerror(errno));
+		}
+		static_cast<jpiheaders&>(*this) = jpiheaders();
+		st = jpi_parse_headers(*this, head.data(), nread);
+		if (st != JPI_ERR_HEADERS_END || (size_t)nread < nWant)
+			break;
+		nWant *= 4;
+	}
+	if (st != JPI_OK) {
+		_close(fd);
+		fileerr("%s: %s", szCurrFile, jpi_strerror(st));
+	}
 
+	for (unsigned iFlight = 0; iFlight < nFlights; iFlight++) {
+		const flight& info = flightlist[iFlight];
+		if (opts.nOnlyFlight && info.flightnum != opts.nOnlyFlight)
+			continue;
 
-static bool test_data_checksum(const void* pBytes, size_t nbytes, byte bTestCheck) {
-	// ignore the firmware version - just check both, but do it in order based on
-	// firmware version for efficiency in most cases
-	if (config.firmware_version < s_NewVersion)
-		return (calc_old_checksum(pBytes, nbytes) == bTestCheck || calc_new_checksum(pBytes, nbytes) == bTestCheck);
-	else
-		return (calc_new_checksum(pBytes, nbytes) == bTestCheck || calc_old_checksum(pBytes, nbytes) == bTestCheck);
+		// The flight's header is at the start of its data
+		jpiflight fl(*this, iFlight);
+		byte fheadbytes[FLIGHTHEADER_SIZE];
+		size_t nTop, nEnd;
+		st = flightoffset(iFlight, nbytes, &nTop, &nEnd);
+		if (st == JPI_OK && readat(fd, nTop, fheadbytes, sizeof(fheadbytes)) != (int)sizeof(fheadbytes))
+			st = JPI_ERR_DATA_ENDS;
+		if (st == JPI_OK)
+			st = fl.read_header(fheadbytes);
+
+		char row[128];
+		int n = sprintf(row, "%-10s %5u %2u.%02u %7u  ", tailnum, config.model,
+			config.firmware_version / 100, config.firmware_version % 100, info.flightnum);
+		if (st == JPI_OK) {
+			ushort y, m, d;
+			ushort hh, mm, ss;
+			decode_datebits(fl.fhead.dt, &m, &d, &y);
+			decode_timebits(fl.fhead.tm, &hh, &mm, &ss);
+			sprintf(row + n, "%2d/%02d/%02d %2d:%02d:%02d %5u %9u", m, d, y, hh, mm, ss,
+				fl.fhead.interval_secs, (unsigned)(info.data_length * sizeof(ushort)));
+		}
+		else
+			sprintf(row + n, "%-34s", jpi_strerror(st));
+		print("%s  %s\n", row, szCurrFile);
+	}
+	_close(fd);
 }
 
 
@@ -1067,393 +2957,829 @@ static bool test_data_checksum(const void* pBytes, size_t nbytes, byte bTestChec
 // The main function for iterating through each flight and parsing out the data
 //
 
-static void parse_data(void)
+void datfile::parse_data(void)
 {
-	assert(s_pHeaderEnd != NULL);
-	byte* pFlight;
-	byte* pEnd;
-	byte* pTop = s_pHeaderEnd;
-	unsigned i;
-	char outbuf[512]; // should be ample
+	assert(pHeaderEnd != NULL);
+	const byte* pEnd;
+	const byte* pTop;
+	char szBadData[128] = { 0 };
+
+	if (opts.bWindow && strcmp(szCurrFile, "-") != 0)
+		load_index();
+
+	// Each flight's data follows right after the previous one's, so where every
+	// flight lives is known up front and they're translated independently.
+	std::vector<std::unique_ptr<flightctx> > flights;
+	for (unsigned iFlight = 0; iFlight < nFlights; iFlight++) {
+
+		// Point at the data for this flight (and it's end), and sanity check the length.
+		// Flights before a bad one still get translated.
+		jpistatus st = findflight(pFileBytes, nFileBytes, iFlight, &pTop, &pEnd);
+		if (st == JPI_ERR_FLIGHT_TOO_SHORT) {
+			sprintf(szBadData, "Flight %u data length too short", flightlist[iFlight].flightnum);
+			break;
+		}
+		if (st != JPI_OK) {
+			strcpy(szBadData, jpi_strerror(st));
+			break;
+		}
 
-	//
-	// Iterate through every flight's data
-	//
-	for (unsigned iFlight = 0; iFlight < s_nFlights; pTop = pEnd, iFlight++) {
+		// Skip this flight if it's one we're not interested in
+		if (opts.nOnlyFlight && flightlist[iFlight].flightnum != opts.nOnlyFlight)
+			continue;
 
-		// Point at the data for this flight (and it's end), and sanity check the length
-		pFlight = pTop;
-		pEnd = pFlight + flightlist[iFlight].data_length * sizeof(ushort);
-		if (pEnd >= s_pFileBytes + s_nFileBytes)
-			errexit("Data ends unexpectedly");
-		if (pEnd - pFlight < sizeof(flightheader))
-			errexit("Flight %u data length too short", flightlist[iFlight].flightnum);
+		flights.push_back(std::unique_ptr<flightctx>(new flightctx(*this, iFlight, pTop, pEnd)));
+	}
 
-		// Skip this flight if it's one we're not interested in
-		if (s_nOnlyFlight && flightlist[iFlight].flightnum != s_nOnlyFlight)
+	taskgroup group;
+	for (size_t i = 0; i < flights.size(); i++) {
+		flightctx* pFlight = flights[i].get();
+		s_pool.run(group, [pFlight]() { pFlight->translate(); });
+	}
+	s_pool.wait(group);
+
+	// Collect the flights' messages in order
+	for (size_t i = 0; i < flights.size(); i++) {
+		log += flights[i]->log;
+		stats.add(flights[i]->stats);
+		if (flights[i]->bFinished) {
+			if (opts.bSummary)
+				summaries.push_back(flights[i]->summaryline);
+			if (opts.bExceedances)
+				exceedances.push_back(flights[i]->limits.events);
+		}
+		if (flights[i]->bFailed)
+			bFailed = true;
+	}
+
+	if (szBadData[0])
+		fileerr("%s", szBadData);
+}
+
+//
+// The .jpidx index that -t uses. Every value of a flight is a difference from
+// the one before, so getting at the rows from part way through a flight
+// means decoding all the records before them. The index saves keyframes of
+// where the decoding was every so many records, so that can start from the
+// last keyframe before the rows wanted instead.
+//
+// The index goes next to the .DAT file, and is made again if the .DAT file
+// changes. It's just the structs below as they are in memory, of fixed-width
+// types so 32 and 64 bit builds, Windows or not, lay it out the same way.
+//
+// Only the flights being translated are indexed (just the one with -f), so
+// a flight can be in the index without its keyframes worked out yet. Those
+// are added to the index the first time -t asks for the flight.
+//
+
+static const unsigned KEYFRAME_RECORDS = 256;	// records between keyframes
+
+#pragma pack(push, 1)
+struct indexheader {
+	char magic[6];										// "JPIDX" and a format number
+	uint16_t nKeyframeSize;							// sizeof(jpikeyframe)
+	uint64_t nFileBytes;								// the .DAT file it's for
+	int64_t tModified;
+	uint32_t nFlights;
+};
+
+struct indexflight {
+	uint32_t nTop;										// where the flight is in the .DAT file
+	uint32_t nKeyframes;								// how many of its keyframes follow the flights, or NOT_INDEXED
+};
+#pragma pack(pop)
+static_assert(sizeof(indexheader) == 28 && sizeof(indexflight) == 8, "the .jpidx records are the same size everywhere");
+
+static const char INDEX_MAGIC[6] = { 'J', 'P', 'I', 'D', 'X', 3 };
+static const uint32_t NOT_INDEXED = 0xffffffff;
+
+// Use the index if it's there and up to date and has the flights wanted,
+// otherwise make it or add them to it
+void datfile::load_index(void)
+{
+	char drive[_MAX_DRIVE];
+	char dir[_MAX_DIR];
+	char name[_MAX_FNAME];
+	char szIndex[_MAX_PATH];
+	_splitpath(szCurrFile, drive, dir, name, NULL);
+	_makepath(szIndex, drive, dir, name, ".jpidx");
+
+	if (!read_index(szIndex)) {
+		keyframes.assign(nFlights, std::vector<jpikeyframe>());
+		indexed.assign(nFlights, false);
+	}
+
+	// The flights are done all at once, like translating them
+	taskgroup group;
+	bool bAdded = false;
+	for (unsigned iFlight = 0; iFlight < nFlights; iFlight++) {
+		if (indexed[iFlight])
+			continue;
+		if (opts.nOnlyFlight && flightlist[iFlight].flightnum != opts.nOnlyFlight)
 			continue;
+		s_pool.run(group, [this, iFlight]() { find_keyframes(iFlight); });
+		indexed[iFlight] = true;
+		bAdded = true;
+	}
+	s_pool.wait(group);
+	if (!bAdded)
+		return;
 
-		// Note that ctor will init datarec appropriately
-		datarec rec;
-		time_t t;
-		flightheader fhead;
+	write_index(szIndex);
+}
+
+// Decode the whole flight, saving a keyframe every KEYFRAME_RECORDS records.
+// Problems with the flight are left for translating it to report.
+void datfile::find_keyframes(unsigned iFlight)
+{
+	const byte* pTop;
+	const byte* pEnd;
+	if (findflight(pFileBytes, nFileBytes, iFlight, &pTop, &pEnd) != JPI_OK)
+		return;
+	jpiflight fl(*this, iFlight);
+	if (fl.begin(pTop, pEnd) != JPI_OK)
+		return;
 
-		// Parse the flight header
-		ushort* usarray = reinterpret_cast<ushort*>(&fhead);
-		for (i = 0; i < sizeof(flightheader) / sizeof(ushort); i++) {
-			usarray[i] = byteswap(*(ushort*)pFlight);
-			pFlight += sizeof(ushort);
+	std::vector<jpikeyframe>& keys = keyframes[iFlight];
+	unsigned nRecords = 0;
+	for (;;) {
+		if (fl.at_record() && nRecords > 0 && nRecords % KEYFRAME_RECORDS == 0) {
+			keys.push_back(jpikeyframe());
+			fl.keyframe(keys.back());
 		}
-		if (!test_data_checksum(&fhead, sizeof(flightheader), *pFlight++))
-			errexit("Flight header checksum failed");
-
-		// Sanity check the flight
-		if (fhead.flightnum != flightlist[iFlight].flightnum)
-			errexit("Flight numbers don't match (%d header, %d data), invalid file", fhead.flightnum, flightlist[iFlight].flightnum);
+		if (fl.next() != JPI_OK)
+			break;
+		if (fl.bNewValues)
+			nRecords++;
+	}
+}
 
-#ifdef DBGOPTS
-		// If we care, dump some bit gunk to the screen
-		if (s_bDebugDetail)
-			dumpflightheader(fhead);
-#endif
+bool datfile::read_index(const char* szIndex)
+{
+	FILE* f = fopen(szIndex, "rb");
+	if (!f)
+		return false;
+
+	indexheader hdr;
+	std::vector<indexflight> flights(nFlights);
+	bool bOk = fread(&hdr, sizeof(hdr), 1, f) == 1
+		&& memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) == 0
+		&& hdr.nKeyframeSize == sizeof(jpikeyframe)
+		&& hdr.nFileBytes == nFileBytes
+		&& hdr.tModified == (int64_t)tModified
+		&& hdr.nFlights == nFlights
+		&& (nFlights == 0 || fread(flights.data(), sizeof(indexflight), nFlights, f) == nFlights);
+
+	keyframes.assign(nFlights, std::vector<jpikeyframe>());
+	indexed.assign(nFlights, false);
+	for (unsigned iFlight = 0; bOk && iFlight < nFlights; iFlight++) {
+		// the flights have to be where the headers say, too
+		const byte* pTop;
+		const byte* pEnd;
+		if (findflight(pFileBytes, nFileBytes, iFlight, &pTop, &pEnd) == JPI_OK && flights[iFlight].nTop != (uint32_t)(pTop - pFileBytes))
+			bOk = false;
+		else if (flights[iFlight].nKeyframes == NOT_INDEXED)
+			continue;
+		else if (flights[iFlight].nKeyframes > nFileBytes)
+			bOk = false;
+		else if (flights[iFlight].nKeyframes) {
+			std::vector<jpikeyframe>& keys = keyframes[iFlight];
+			keys.resize(flights[iFlight].nKeyframes);
+			bOk = fread(keys.data(), sizeof(jpikeyframe), keys.size(), f) == keys.size();
+		}
+		indexed[iFlight] = bOk;
+	}
+	fclose(f);
 
-		// Get the time...
-		t = inittime(fhead.dt, fhead.tm);
+	if (!bOk)
+		keyframes.clear();
+	return bOk;
+}
 
-		// HACK ALERT UNTIL WE FIGURE OUT WHY THE SECONDS IS SOMETIMES ALL OUT OF WHACK!!
-		// There's probably a bit field somewhere that controls this (perhaps one of the
-		// bits in fhead.unknown_value?), but don't know which one yet. Given a few
-		// examples it's probably not too hard to track down.
-		if (fhead.interval_secs < 2 || 512 < fhead.interval_secs)
-			fhead.interval_secs = 6;
+// The index is only a help, so there's no complaint if it can't be written
+void datfile::write_index(const char* szIndex) const
+{
+	FILE* f = fopen(szIndex, "wb");
+	if (!f)
+		return;
 
-		// Open the output file
-		opencsv(fhead.flightnum);
+	indexheader hdr;
+	memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.nKeyframeSize = sizeof(jpikeyframe);
+	hdr.nFileBytes = nFileBytes;
+	hdr.tModified = tModified;
+	hdr.nFlights = nFlights;
+	bool bOk = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+	for (unsigned iFlight = 0; bOk && iFlight < nFlights; iFlight++) {
+		const byte* pTop;
+		const byte* pEnd;
+		indexflight fl;
+		fl.nTop = 0;
+		if (findflight(pFileBytes, nFileBytes, iFlight, &pTop, &pEnd) == JPI_OK)
+			fl.nTop = (uint32_t)(pTop - pFileBytes);
+		fl.nKeyframes = indexed[iFlight] ? (uint32_t)keyframes[iFlight].size() : NOT_INDEXED;
+		bOk = fwrite(&fl, sizeof(fl), 1, f) == 1;
+	}
+	for (unsigned iFlight = 0; bOk && iFlight < nFlights; iFlight++) {
+		const std::vector<jpikeyframe>& keys = keyframes[iFlight];
+		if (!keys.empty())
+			bOk = fwrite(keys.data(), sizeof(jpikeyframe), keys.size(), f) == keys.size();
+	}
+	if (fclose(f) != 0 || !bOk)
+		remove(szIndex);
+}
 
-		// Output the CSV headers
-		outputheaders(fhead);
 
-		// save this for various loops - syntactical shorthand
-		unsigned nCyl = NUMCYLS(fhead.flags);
+flightctx::flightctx(const datfile& f, unsigned iFlight, const byte* top, const byte* end)
+	: msglog(f.bHoldOutput), jpiflight(f, iFlight), file(f), opts(f.opts), pTop(top), pEnd(end), iFlight(iFlight), rowtime(f.opts.bUTC)
+{
+	t = tStart = 0;
+	tFrom = tTo = tFirstRow = tLastRow = 0;
+	nColumns = 0;
+	bWhereCurrent = bWhereMatch = false;
+	bValuesCurrent = false;
+	nRows = nCachedRows = 0;
+	pStats = opts.bStats ? &stats : NULL;
+	stats.nFlights = 1;
+	bFinished = false;
+	szOutputCSV[0] = szTempCSV[0] = 0;
+#ifdef DBGOPTS
+	fCompareCSV = NULL;
+#endif
+	DurationOffset = 0;
+}
 
+void flightctx::translate(void)
+{
+	try {
+		check(begin(pTop, pEnd));
+		start();
+
+		// With -t, skip ahead to the last keyframe before the rows wanted
+		if (opts.bWindow && iFlight < file.keyframes.size()) {
+			const jpikeyframe* pKey = NULL;
+			const std::vector<jpikeyframe>& keys = file.keyframes[iFlight];
+			for (size_t i = 0; i < keys.size() && keys[i].nRow * fhead.interval_secs <= opts.nFromSecs; i++)
+				pKey = &keys[i];
+			if (pKey) {
+				phasetimer timer(pStats, PHASE_DECODE);
+				check(seek(*pKey));
+				t = tStart + (time_t)nRow * fhead.interval_secs;
+			}
+		}
 
 		//
-		// Loop across each data record
+		// Loop across each row, which is a data record or a repeat of one
 		//
-
-
-		// Will always read at least 3 bytes, and this ensures we don't go past
-		// the end in the event that the data record ends on an odd byte count.
-		// (Recall the length spec'd in the headers is given as # of 2 byte words.)
-		while ((pFlight + 3) < pEnd) {
-
-			// save top of record for later checksumming
-			byte* pDataRec = pFlight;
-
-			// Get the first flags that flag which "sets" of data are there
-			byte decodeflags[2];
-			byte repeatcount;
-			decodeflags[0] = *pFlight++;
-			decodeflags[1] = *pFlight++;
-
-			// Get the repeat count
-			repeatcount = *pFlight++;
+		jpistatus st = JPI_OK;
+		while (!(opts.bWindow && t >= tTo)) {
+			{
+				phasetimer timer(pStats, PHASE_DECODE);
+				st = next();
+			}
+			if (st != JPI_OK)
+				break;
+			if (bNewValues) {
+				bValuesCurrent = bWhereCurrent = false;	// rec has changed
+				stats.nRecords++;
 #ifdef DBGOPTS
-			if (s_bDebugDetail) // dump debugging junk if we care
-				printf("decode  %02x %02x   repeat %02x\n", decodeflags[0], decodeflags[1], repeatcount);
+				if (opts.bDebugDetail)
+					dumprecord(pRecord, nRecordBytes);
 #endif
-			assert(decodeflags[0] == decodeflags[1]); // draw attention to something not seen before
-
-			// The repeat count, if present, indicates we should just spit out the
-			// previous data that many times (incrementing the timestamp appropriately).
-			while (repeatcount--) {
-				formatdata(t, rec, outbuf, sizeof(outbuf));
-				outputline(outbuf);
-				t += fhead.interval_secs;
 			}
-
+			else
+				stats.nRepeats++;
+			nextrow();
+		}
 #ifdef DBGOPTS
-			// More debug output handy if we are puzzling out the data file format
-			if (s_bDebugDetail) {
-				printf("sign/scale bytes:");
-				byte* pTmp = pFlight;
-				for (i = 0; i < 8; i++) {
-					if (decodeflags[0] & (1 << i))
-						printf(" %02x", *pTmp++);
-					else
-						printf("   ");
-				}
-				// Why only 6?? 'cause otherwise we duplicate the scale bits, I guess, and they don't ever do that.
-				// Unclear on why there are two decodeflags - they always seem to be equal.
-				// I've never seen scale flags for CHT or other value sets, just EGT values.
-				for (i = 0; i < 6; i++) {
-					if (decodeflags[1] & (1 << i))
-						printf(" %02x", *pTmp++);
-					else
-						printf("   ");
-				}
-				printf("\n");
-			}
+		if (st == JPI_ERR_DATA_CHECKSUM && opts.bDebugDetail)
+			dumprecord(pRecord, nRecordBytes);
 #endif
+		if (st != JPI_OK && st != JPI_END)
+			check(st);
 
-			// Bit flags that indicate the existence of a given field 
-			// in the compressed stream of difference values.
-			byte valflags[6];
-			byte scaleflags[2];						// flags presence of the EGT scale values
-			byte signflags[6];						// indicates sign of dif value
-
-			memset(valflags, 0, sizeof(valflags));
-			memset(scaleflags, 0, sizeof(scaleflags));
-			memset(signflags, 0, sizeof(signflags));
-
-			// The presence of one of the bits of decodeflags indicates that
-			// at least one of the group of eight fields of a "set" is present
-			// and that set's flags will be present.
-			for (i = 0; i < countof(valflags); i++)
-				if (decodeflags[0] & (1 << i))
-					valflags[i] = *pFlight++;
-
-			// Check existence of the EGT scale value sets
-			for (i = 0; i < countof(scaleflags); i++)
-				if (decodeflags[0] & (0x40 << i))
-					scaleflags[i] = *pFlight++;
-			// never seen otherwise - draw attention to new case
-			assert(scaleflags[1] == 0 || NUMENGINE() > 1);
-
-			// Get the sign bits
-			for (i = 0; i < countof(signflags); i++)
-				if (decodeflags[1] & (1 << i))
-					signflags[i] = *pFlight++;
-
-			// Values are stored as 8 bit difference from previous value (except EGTs
-			// which could be a 16 bit difference from previous value). Sign
-			// bit determines whether the difference value is added or subtracted.
-			// For the EGT/TIT fields, scale bit determines whether the high 
-			// order byte of a two byte value is stored.
-			//
-			// Note that a difference flagged to exist but equal to zero is
-			// the flag for "NA". This logic is not perfectly implemented below
-			// but is hacked in to work for the most part. A little more effort
-			// could refine the overall elegance a little.
-
-			for (i = 0; i < sizeof(valflags) * 8; i++) {
-				if (testbit(valflags, i)) {
-					if (*pFlight == 0)
-						setbit(rec.naflags, i);
-					else
-						clearbit(rec.naflags, i);
-					if (testbit(signflags, i))
-						rec.sarray[i] -= *pFlight++;
-					else
-						rec.sarray[i] += *pFlight++;
-				}
-			}
-
-			for (unsigned j = 0; j < sizeof(scaleflags); j++) {
-				for (i = 0; i < 8; i++) {
-					if (testbit(scaleflags + j, i)) {
-						unsigned idx = j * TWINJUMP + i;
-						ushort x = *pFlight++;
-						if (x != 0) {
-							clearbit(rec.naflags, idx);
-							x <<= 8;
-							if (testbit(signflags, idx))
-								rec.sarray[idx] -= x;
-							else
-								rec.sarray[idx] += x;
-						}
-						// else... note that the low byte of the dif value
-						// would have set the naflags bit already if the
-						// high byte and low byte were both zero
-					}
-				}
-			}
-
-			// HACK ALERT - special case the RPM high byte since it follows
-			// the sign of the RPM field and doesn't appear to follow its
-			// own sign bit.
-			if (NUMENGINE() == 1) {
-				if (testbit(signflags, RPM_FIELD_NUM)) {
-					assert(!testbit(signflags, RPM_HIGHBYTE_FIELD_NUM));
-					rec.rpm_highbyte = -rec.rpm_highbyte;
-				}
-				if (rec.rpm_highbyte != 0)
-					clearbit(rec.naflags, RPM_FIELD_NUM);
-			}
-
-			// Compute the DIF field
-			rec.calcstuff(fhead.flags);
+		finish();
+	}
+	catch (const fileabort&) {
+		bFailed = true;
+	}
+}
 
-			if (pFlight >= pEnd)
-				errexit("Unexpected end of data record");
-			if (!test_data_checksum(pDataRec, pFlight - pDataRec, *pFlight)) {
+// Give up on the flight if the decoder had a problem with it
+void flightctx::check(jpistatus st)
+{
+	switch (st) {
+	case JPI_OK:
+		return;
+	case JPI_ERR_FLIGHT_NUMBER:
+		fileerr("Flight numbers don't match (%d header, %d data), invalid file", fhead.flightnum, info.flightnum);
+		return;
+	case JPI_ERR_DATA_CHECKSUM:
+		stats.nChecksumErrors++;
+		fileerr("%s", jpi_strerror(st));
+		return;
+	default:
+		fileerr("%s", jpi_strerror(st));
+		return;
+	}
+}
 
+void flightctx::start(void)
+{
 #ifdef DBGOPTS
-				// DEBUGGING JUNK - dump the bytes of records which don't checksum correctly
-				// so we can scrutinize them a bit.
-				if (s_bDebugDetail) {
-					int nprint = 0;
-					while (pDataRec < pFlight) {
-						if (!(nprint % 16))
-							printf("\n%08X:", nprint);
-						if (!(nprint % 2))
-							printf(" ");
-						printf("%02x", *pDataRec++);
-						nprint++;
-					}
-					printf("\n");
-				}
+	// If we care, dump some bit gunk to the screen
+	if (opts.bDebugDetail)
+		dumpflightheader(fhead);
 #endif
 
-				errexit("Data checksum failed");
-
-			}
-			pFlight++;
+	// Get the time...
+	if (opts.bUTC)
+		tStart = inittime_utc(fhead.dt, fhead.tm);
+	else
+		tStart = inittime(fhead.dt, fhead.tm);
+	t = tStart;
+	tFrom = tStart + opts.nFromSecs;
+	tTo = tStart + opts.nToSecs;
+
+	plancolumns();
+	if (opts.bExceedances)
+		planlimits();
+	if (opts.bSummary || opts.bExceedances)
+		return;
 
-			// Output the CSV line
-			formatdata(t, rec, outbuf, sizeof(outbuf));
-			outputline(outbuf);
-			t += fhead.interval_secs;
+	// Open the output file
+	opencsv(fhead.flightnum);
 
-		} // END WHILE() (the data record loop)
+	// Output the CSV headers
+	if (opts.bArrow)
+		outputschema(fhead);
+	else
+		outputheaders(fhead);
+}
 
-		// Go back and fix the text in the CSV headers
-		write_duration(t - fhead.interval_secs /* subtract the last iteration*/, fhead);
+// Decode the data record at pDataRec (nbytes long, as given by
+// jpi_record_size()) and write out its CSV lines
+void flightctx::decode_record(const byte* pDataRec, size_t nbytes)
+{
+	// The repeat count, if present, indicates we should just spit out the
+	// previous data that many times (incrementing the timestamp appropriately).
+	for (unsigned nRepeat = jpi_repeat_count(pDataRec); nRepeat; nRepeat--) {
+		stats.nRepeats++;
+		nextrow();
+	}
+	bValuesCurrent = bWhereCurrent = false;	// rec is about to change
 
+	jpistatus st;
+	{
+		phasetimer timer(pStats, PHASE_DECODE);
+		st = decode(pDataRec, nbytes);
+	}
+	stats.nRecords++;
 #ifdef DBGOPTS
-		if (s_bDebugDetail)
-			printf("\n");
+	if (opts.bDebugDetail)
+		dumprecord(pDataRec, nbytes);
 #endif
+	check(st);
 
-		// End of flight data, close the CSV file
-		closecsv();
-
-	}
+	// Output the CSV line
+	nextrow();
 }
 
-
-//
-// This corresponds to the -r flag, which will change the .DAT file to
-// use the older checksum scheme and allow EZSave to work as it used to.
-//
-static void recompute_checksums(void)
+#ifdef DBGOPTS
+// Show the flags of a data record, and all of it if it doesn't checksum
+// correctly, so we can scrutinize it a bit
+void flightctx::dumprecord(const byte* pDataRec, size_t nbytes)
 {
-	assert(s_pHeaderEnd != NULL);
-	byte* pFlight;
-	byte* pEnd;
-	byte* pRec;
-	byte* pTop = s_pHeaderEnd;
 	unsigned i;
+	const byte* pTmp = pDataRec + 3;
+	byte decodeflags[2] = { pDataRec[0], pDataRec[1] };
+
+	print("decode  %02x %02x   repeat %02x\n", decodeflags[0], decodeflags[1], jpi_repeat_count(pDataRec));
+	print("sign/scale bytes:");
+	for (i = 0; i < 8; i++) {
+		if (decodeflags[0] & (1 << i))
+			print(" %02x", *pTmp++);
+		else
+			print("   ");
+	}
+	// Why only 6?? 'cause otherwise we duplicate the scale bits, I guess, and they don't ever do that.
+	// Unclear on why there are two decodeflags - they always seem to be equal.
+	// I've never seen scale flags for CHT or other value sets, just EGT values.
+	for (i = 0; i < 6; i++) {
+		if (decodeflags[1] & (1 << i))
+			print(" %02x", *pTmp++);
+		else
+			print("   ");
+	}
+	print("\n");
+
+	if (!file.test_data_checksum(pDataRec, nbytes - 1, pDataRec[nbytes - 1])) {
+		for (size_t nprint = 0; nprint < nbytes - 1; nprint++) {
+			if (!(nprint % 16))
+				print("\n%08X:", (unsigned)nprint);
+			if (!(nprint % 2))
+				print(" ");
+			print("%02x", pDataRec[nprint]);
+		}
+		print("\n");
+	}
+}
+#endif // DBGOPTS
 
-	// Note: if we don't get the new version info right
-	if (config.firmware_version < s_NewVersion) {
-		printf("This data file is the older version and doesn't need to be changed\n");
+void flightctx::finish(void)
+{
+	if (opts.bSummary || opts.bExceedances) {
+		if (opts.bSummary)
+			formatsummary();
+		for (unsigned i = 0; i < limits.nChecks; i++) {
+			if (limits.checks[i].bActive)
+				endevent(limits.checks[i], t - fhead.interval_secs);
+		}
+		bFinished = true;
 		return;
 	}
 
-	//
-	// Iterate through every flight's data
-	//
-	for (unsigned iFlight = 0; iFlight < s_nFlights; pTop = pEnd, iFlight++) {
-
-		// Point at the data for this flight (and it's end), and sanity check the length
-		pFlight = pTop;
-		pEnd = pFlight + flightlist[iFlight].data_length * sizeof(ushort);
-		if (pEnd >= s_pFileBytes + s_nFileBytes)
-			errexit("Data ends unexpectedly");
-		if (pEnd - pFlight < sizeof(flightheader))
-			errexit("Flight %u data length too short", flightlist[iFlight].flightnum);
+	// Go back and fix the text in the CSV headers
+	if (pArrow) {
+		pArrow->end();
+		if (OutputCSV.error())
+			fileerr("Error writing output file.\n%s", strerror(OutputCSV.error()));
+	}
+	else if (opts.bWindow)
+		write_duration(tFirstRow, tLastRow);
+	else
+		write_duration(tStart, t - fhead.interval_secs /* subtract the last iteration*/);
 
-		pRec = pFlight;
-		pFlight += sizeof(flightheader);
+#ifdef DBGOPTS
+	if (opts.bDebugDetail)
+		print("%lu rows, %lu of them repeats that reused the rendered values\n\n", nRows, nCachedRows);
+#endif
 
-		// Rechecksum the flight header
-		if (!test_data_checksum(pRec, pFlight - pRec, *pFlight))
-			errexit("Flight header checksum failed");
+	// End of flight data, close the CSV file
+	closecsv();
+}
 
-		*pFlight++ = calc_old_checksum(pRec, pFlight - pRec);
 
+//
+// Decoding a .DAT file that can only be read front to back, like standard
+// input or a pipe. Bytes are fed in whatever chunks they arrive in, and the
+// only thing held over from one chunk to the next is a header record or data
+// record split between them, so memory use stays the same however big the
+// file is. CSV lines are written as each record is decoded.
+//
+class streamdecoder {
+	datfile& file;
+	enum { HEADERS, FLIGHTHEADER, RECORDS, SKIP, DONE } state;
+	byte carry[256 + 2];								// a header record and its CR/LF, or a data record
+	size_t nCarry;
+	size_t nOffset;									// file offset of the next byte fed
+	unsigned iFlight;									// flight being decoded (or skipped)
+	size_t nFlightLeft;								// bytes of it not yet fed
+	std::unique_ptr<flightctx> pCurrFlight;	// NULL while skipping
+
+	bool step(const byte*& p, size_t& n);
+	bool gather(const byte*& p, size_t& n, size_t nWant);
+	void skip(const byte*& p, size_t& n, size_t nbytes);
+	void nextflight(void);
+	void endflight(bool bFailed);
 
-		//
-		// Loop across each data record
-		//
+public:
+	streamdecoder(datfile& f)
+		: file(f), state(HEADERS), nCarry(0), nOffset(0), iFlight(0), nFlightLeft(0) {}
 
+	void feed(const byte* p, size_t n);
+	void finish(void);
+};
 
-		// Will always read at least 3 bytes, and this accounts for the possibility
-		// that the data record ends on an odd byte count even though the length
-		// spec'd in the headers is given as # of words.
-		while ((pFlight + 3) < pEnd) {
+void streamdecoder::feed(const byte* p, size_t n)
+{
+	for (;;) {
+		try {
+			if (!step(p, n))
+				return;
+		}
+		catch (const fileabort&) {
+			// A bad flight is given up on and the rest of the file carries on,
+			// the same as when it's all in memory
+			if (state != FLIGHTHEADER && state != RECORDS)
+				throw;
+			endflight(true);
+		}
+	}
+}
 
-			pRec = pFlight;
+// Called after the last chunk
+void streamdecoder::finish(void)
+{
+	if (state == HEADERS)
+		file.fileerr("Unexpected end of .DAT file");
+	if (state != DONE) {
+		if (pCurrFlight)
+			endflight(true);
+		file.fileerr("Data ends unexpectedly");
+	}
+}
 
-			byte decodeflags[2];
+// Work on as much of the n bytes at p as makes sense. Returns false when it
+// needs more bytes to get any further.
+bool streamdecoder::step(const byte*& p, size_t& n)
+{
+	size_t nbytes;
+
+	switch (state) {
+	case HEADERS: {
+		if (n == 0)
+			return false;
+		const byte* lf = (const byte*)memchr(p, '\n', n);
+		nbytes = lf ? lf - p + 1 : n;
+		if (nCarry + nbytes > sizeof(carry))
+			file.fileerr("Header record too long at offset %u", (unsigned)(nOffset - nCarry));
+		gather(p, n, nCarry + nbytes);
+		if (!lf)
+			return false;
+
+		// work on a terminated copy of the line, less the CR/LF
+		size_t nLine = nCarry - 1;
+		if (nLine > 0 && carry[nLine - 1] == '\r')
+			nLine--;
+		carry[nLine] = 0;
+		size_t nLineOffset = nOffset - nCarry;
+		nCarry = 0;
+		bool bLast;
+		{
+			phasetimer timer(file.pStats, PHASE_HEADERS);
+			bLast = file.parse_header((char*)carry, nLine, nLineOffset);
+		}
+		if (bLast) {
+#ifdef DBGOPTS
+			if (file.opts.bNoFlights) {
+				state = DONE;
+				return false;
+			}
+#endif
+			nextflight();
+		}
+		return true;
+	}
 
-			decodeflags[0] = *pFlight++;
-			decodeflags[1] = *pFlight++;
-			pFlight++; // repeatcount
+	case FLIGHTHEADER:
+		if (!gather(p, n, FLIGHTHEADER_SIZE))
+			return false;
+		nCarry = 0;
+		state = RECORDS;
+		pCurrFlight->check(pCurrFlight->read_header(carry));
+		pCurrFlight->start();
+		return true;
+
+	case RECORDS:
+		// Same test as flightctx::translate() for the end of the records
+		if (nCarry == 0 && nFlightLeft <= 3) {
+			endflight(false);
+			return true;
+		}
 
+		// Decode the record right where it is if it's all in this chunk...
+		if (nCarry == 0) {
+			size_t nAvail = min(n, nFlightLeft);
+			if ((nbytes = jpi_record_size(p, nAvail)) <= nAvail) {
+				pCurrFlight->decode_record(p, nbytes);
+				skip(p, n, nbytes);
+				return true;
+			}
+		}
 
-			byte valflags[6];
-			byte scaleflags[2];
+		// ...otherwise put it together in the carry-over buffer
+		while ((nbytes = jpi_record_size(carry, nCarry)) > nCarry) {
+			if (nbytes - nCarry > nFlightLeft)
+				pCurrFlight->fileerr("Unexpected end of data record");
+			if (!gather(p, n, nbytes))
+				return false;
+		}
+		nCarry = 0;
+		pCurrFlight->decode_record(carry, nbytes);
+		return true;
+
+	case SKIP:
+		if (nFlightLeft > 0) {
+			if (n == 0)
+				return false;
+			skip(p, n, min(n, nFlightLeft));
+			return true;
+		}
+		iFlight++;
+		nextflight();
+		return true;
 
-			memset(valflags, 0, sizeof(valflags));
-			memset(scaleflags, 0, sizeof(scaleflags));
+	case DONE:
+		// anything after the last flight is ignored
+		return false;
+	}
+	return false;
+}
 
-			for (i = 0; i < countof(valflags); i++)
-				if (decodeflags[0] & (1 << i))
-					valflags[i] = *pFlight++;
+// Add bytes to the carry-over buffer until it has nWant of them, and return
+// true if it does
+bool streamdecoder::gather(const byte*& p, size_t& n, size_t nWant)
+{
+	assert(nCarry <= nWant && nWant <= sizeof(carry));
+	size_t nbytes = min(n, nWant - nCarry);
+	memcpy(carry + nCarry, p, nbytes);
+	nCarry += nbytes;
+	skip(p, n, nbytes);
+	return nCarry == nWant;
+}
 
-			// Seems to be the only egt scale flags ever present (??)
-			for (i = 0; i < countof(scaleflags); i++)
-				if (decodeflags[0] & (0x40 << i))
-					scaleflags[i] = *pFlight++;
+void streamdecoder::skip(const byte*& p, size_t& n, size_t nbytes)
+{
+	assert(nbytes <= n);
+	p += nbytes;
+	n -= nbytes;
+	nOffset += nbytes;
+	if (state != HEADERS) {
+		assert(nbytes <= nFlightLeft);
+		nFlightLeft -= nbytes;
+	}
+}
 
-			// never seen otherwise - draw attention to new case
-			assert(scaleflags[1] == 0 || NUMENGINE() > 1);
+void streamdecoder::nextflight(void)
+{
+	if (iFlight >= file.nFlights) {
+		state = DONE;
+		return;
+	}
 
-			// These are the sign flags
-			for (i = 0; i < countof(valflags); i++)
-				if (decodeflags[1] & (1 << i))
-					pFlight++;
+	const flight& info = file.flightlist[iFlight];
+	nFlightLeft = info.data_length * sizeof(ushort);
+	if (nFlightLeft < FLIGHTHEADER_SIZE)
+		file.fileerr("Flight %u data length too short", info.flightnum);
 
+	// Skip this flight if it's one we're not interested in
+	if (file.opts.nOnlyFlight && info.flightnum != file.opts.nOnlyFlight) {
+		state = SKIP;
+		return;
+	}
+	pCurrFlight.reset(new flightctx(file, iFlight, NULL, NULL));
+	state = FLIGHTHEADER;
+}
 
-			// Now just loop through the various flags, skip that many bytes,
-			// and recalc the checksum when we're done.
-			for (i = 0; i < sizeof(valflags) * 8; i++)
-				if (testbit(valflags, i))
-					pFlight++;
+// Done with the flight's records, so skip any padding to the next flight
+void streamdecoder::endflight(bool bFailed)
+{
+	if (bFailed)
+		file.bFailed = true;
+	else
+		pCurrFlight->finish();
+	file.log += pCurrFlight->log;
+	file.stats.add(pCurrFlight->stats);
+	if (pCurrFlight->bFinished) {
+		if (file.opts.bSummary)
+			file.summaries.push_back(pCurrFlight->summaryline);
+		if (file.opts.bExceedances)
+			file.exceedances.push_back(pCurrFlight->limits.events);
+	}
+	pCurrFlight.reset();
+	nCarry = 0;
+	state = SKIP;
+}
 
-			for (i = 0; i < sizeof(scaleflags) * 8; i++)
-				if (testbit(scaleflags, i))
-					pFlight++;
+void datfile::stream_file(int fd)
+{
+	if (opts.bRecalcChecksums) {
+		_close(fd);
+		fileerr("-r needs a .DAT file it can read all at once, not a pipe");
+	}
 
-			if (pFlight >= pEnd)
-				errexit("Unexpected end of data record");
+	streamdecoder decoder(*this);
+	byte chunk[64 * 1024];
+	int nread;
+	try {
+		for (;;) {
+			{
+				phasetimer timer(pStats, PHASE_READ);
+				nread = _read(fd, chunk, sizeof(chunk));
+			}
+			if (nread <= 0)
+				break;
+			stats.nBytes += nread;
+			decoder.feed(chunk, nread);
+		}
+		if (nread < 0)
+			fileerr("Error reading file %s\n%s", szCurrFile, strerror(errno));
+		decoder.finish();
+	}
+	catch (const fileabort&) {
+		_close(fd);
+		throw;
+	}
+	_close(fd);
+}
 
-			if (!test_data_checksum(pRec, pFlight - pRec, *pFlight))
-				errexit("Data checksum failed");
 
-			*pFlight++ = calc_old_checksum(pRec, pFlight - pRec);
+//
+// This corresponds to the -r flag, which will change the .DAT file to
+// use the older checksum scheme and allow EZSave to work as it used to.
+//
+void datfile::recompute_checksums(void)
+{
+	assert(pHeaderEnd != NULL);
 
-		} // END WHILE()
+	// Note: if we don't get the new version info right
+	if (config.firmware_version < NewVersion) {
+		print("This data file is the older version and doesn't need to be changed\n");
+		return;
+	}
 
+	// Put in the $C record with the older firmware version...
+	std::vector<std::vector<patch> > patches(nFlights + 1);
+	std::string oldconfig;
+	if (old_config_header(pFileBytes, oldconfig)) {
+		for (size_t i = 0; i < oldconfig.size(); i++) {
+			if ((byte)oldconfig[i] != pFileBytes[nConfigOffset + i]) {
+				patch pt = { nConfigOffset + i, (byte)oldconfig[i] };
+				patches[0].push_back(pt);
+			}
+		}
+	}
 
+	// ...and find every flight's checksums that need changing, the flights
+	// all at once
+	std::vector<jpistatus> status(nFlights, JPI_OK);
+	taskgroup group;
+	for (unsigned iFlight = 0; iFlight < nFlights; iFlight++) {
+		s_pool.run(group, [this, iFlight, &patches, &status]() {
+			status[iFlight] = old_checksums(iFlight, patches[iFlight + 1]);
+		});
 	}
+	s_pool.wait(group);
+
+	// The first bad flight spoils the whole file
+	for (unsigned iFlight = 0; iFlight < nFlights; iFlight++) {
+		if (status[iFlight] == JPI_ERR_FLIGHT_TOO_SHORT)
+			fileerr("Flight %u data length too short", flightlist[iFlight].flightnum);
+		if (status[iFlight] != JPI_OK)
+			fileerr("%s", jpi_strerror(status[iFlight]));
+	}
+
+	write_patched_file("-HACK", ".DAT", patches);
+}
 
-	write_renamed_file("-HACK", ".DAT");
+// Find the checksums of a flight's header and data records that are different
+// with the older firmware's XOR checksum
+jpistatus datfile::old_checksums(unsigned iFlight, std::vector<patch>& patches) const
+{
+	const byte* pTop;
+	const byte* pEnd;
+	jpistatus st = findflight(pFileBytes, nFileBytes, iFlight, &pTop, &pEnd);
+	if (st != JPI_OK)
+		return st;
+
+	// Rechecksum the flight header
+	const byte* pFlight = pTop + sizeof(flightheader);
+	if (!old_checksum(pTop, pFlight, patches))
+		return JPI_ERR_FLIGHT_CHECKSUM;
+	pFlight++;
+
+	// Will always read at least 3 bytes, and this accounts for the possibility
+	// that the data record ends on an odd byte count even though the length
+	// spec'd in the headers is given as # of words.
+	while (pFlight + 3 < pEnd) {
+		size_t nbytes = jpi_record_size(pFlight, pEnd - pFlight);
+		if (nbytes > (size_t)(pEnd - pFlight))
+			return JPI_ERR_RECORD_ENDS;
+		if (!old_checksum(pFlight, pFlight + nbytes - 1, patches))
+			return JPI_ERR_DATA_CHECKSUM;
+		pFlight += nbytes;
+	}
+	return JPI_OK;
+}
 
+// Check the checksum at pCheck of the bytes from pRec, and if the XOR one
+// is different, add the patch for it
+bool datfile::old_checksum(const byte* pRec, const byte* pCheck, std::vector<patch>& patches) const
+{
+	jpichecksums sums = jpi_checksums(pRec, pCheck - pRec);
+	if (sums.negsum != *pCheck && sums.xorsum != *pCheck)
+		return false;
+	if (sums.xorsum != *pCheck) {
+		patch pt = { (size_t)(pCheck - pFileBytes), sums.xorsum };
+		patches.push_back(pt);
+	}
+	return true;
 }
 
 static void usage(void)
 {
 	printf(
 #ifdef DBGOPTS
-		"JPIHACK [-r] [-s] [-c] [-f#] [-h] [-d] [-n] datfiles\n"
+		"JPIHACK [-r] [-s] [-u] [-j#] [--format fmt] [--catalog] [--summary] [--exceedances] [--stats[=json]] [--columns list] [--where expr] [-c] [-f#] [-t from-to] [-h] [-d] [-n] datfiles\n"
 #else
-		"JPIHACK [-r] [-s] [-f#] datfiles\n"
+		"JPIHACK [-r] [-s] [-u] [-j#] [--format fmt] [--catalog] [--summary] [--exceedances] [--stats[=json]] [--columns list] [--where expr] [-f#] [-t from-to] datfiles\n"
 #endif
 		"\n"
 		"  datfiles are a list of .DAT or .JPI files to translate, wildcards allowed.\n"
+		"  A - reads a .DAT file from standard input, with the CSV files written to\n"
+		"  the current directory. Pipes are translated as the data arrives.\n"
 		"\n"
 		"  -r      Instead of translating the .DAT file to .CSV files, this will\n"
 		"          merely change the .DAT file back to the older format which is\n"
@@ -1464,7 +3790,62 @@ static void usage(void)
 		"          with .DAT extension names so EZSave will find them easily.\n"
 		"\n"
 		"  -s      Suppress CSV file name suffixing (i.e. no Fnnnnn-HACK.CSV naming)\n"
+		"  -u      Write the TIME column as the recorded ISO-8601 date and time\n"
+		"          (e.g. 2005-06-23T10:59:10), with no time zone, leaving the\n"
+		"          computer's time zone setting out of it\n"
 		"  -f#     Display only flight #'s data (# is numeric value)\n"
+		"  -t from-to\n"
+		"          Only write the rows from one time to another, each given as h:mm or\n"
+		"          h:mm:ss into the flight (1:00-1:30, say, or 2:00- for the rest of\n"
+		"          it). An index of each flight it's used on is kept next to the .DAT\n"
+		"          file as a .jpidx file, so the next time the rows before can be\n"
+		"          skipped instead of decoded.\n"
+		"  -j#     Use up to # threads, translating several files and the flights\n"
+		"          within them at once (-j alone uses every processor). Each file's\n"
+		"          messages are shown together when it's done, and a file with\n"
+		"          errors doesn't stop the rest of the batch.\n"
+		"  --format csv|arrow\n"
+		"          Write each flight as a CSV file (the default) or as an Apache Arrow\n"
+		"          IPC file, Fnnnnn.arrow, with typed columns and nulls for NA values\n"
+		"  --catalog\n"
+		"          Instead of translating, list the flights in each file with their\n"
+		"          tail number, model, firmware, flight #, date, recording interval and\n"
+		"          length. Only the headers are read, so with -j a whole archive of\n"
+		"          .DAT files is quick to go through.\n"
+		"  --summary\n"
+		"          Instead of a CSV file for each flight, write one summary file for\n"
+		"          each .DAT file (R4-SUMMARY.CSV for R4.DAT) with a line per flight:\n"
+		"          its date, length and gallons burned, the seconds spent over the\n"
+		"          CHT, DIF, TIT and oil limits set in the instrument, and the least,\n"
+		"          most and mean of every column\n"
+		"  --exceedances\n"
+		"          Instead of a CSV file for each flight, write one file for each .DAT\n"
+		"          file (R4-EXCEEDANCES.CSV for R4.DAT) of the times a value went past\n"
+		"          its limit set in the instrument (CHT, TIT, DIF, oil, volts and CLD),\n"
+		"          with when it started and ended and the worst of it. A CHT falling\n"
+		"          faster than the CLD limit over a minute is listed as COOLING.\n"
+		"          Goes with --summary too. Rows left out by -t or --where end an\n"
+		"          event, and the minute of CHTs for COOLING starts over after them.\n"
+		"  --stats[=json]\n"
+		"          After each file, show how long reading, header parsing, decoding,\n"
+		"          formatting and writing took, and how many bytes, flights, records,\n"
+		"          repeats, rows and checksum errors there were, with totals for the\n"
+		"          batch at the end. =json makes each of those a line of JSON.\n"
+		"  --columns list\n"
+		"          Only write the columns named in the list, separated by commas\n"
+		"          (E1,E2,C1,C2,FF,RPM, say). Each name is a column title as it would\n"
+		"          be in the CSV file, and for twins L or R in front picks one engine,\n"
+		"          or without either it's both. The columns stay in their usual order,\n"
+		"          TIME and MARK are always there, and --summary and --exceedances\n"
+		"          only look at the columns listed.\n"
+		"  --where expr\n"
+		"          Only keep the rows that match expr, like \"CHT>400 || DIF>150 ||\n"
+		"          OIL<40\": comparisons (<, <=, >, >=, ==, !=) of columns with numbers,\n"
+		"          joined by && and || and turned around by !, with parentheses. A\n"
+		"          column is named by its title, L or R in front for one engine of a\n"
+		"          twin, or CHT, EGT or TIT for any cylinder's. A comparison with an NA\n"
+		"          value, or a column the flight doesn't have, is false. Like -t, it\n"
+		"          applies to --summary and --exceedances too.\n"
 #ifdef DBGOPTS
 		"  -c      Compare to existing CSV files and show diffs\n"
 		"  -h      Display RAW DAT file header records\n"
@@ -1486,55 +3867,419 @@ static void usage(void)
 }
 
 
+// Times for -t are h:mm or h:mm:ss
+static bool parseclock(const char*& p, ulong& nSecs)
+{
+	ulong parts[3];
+	int n = 0;
+	while (n < 3 && isdigit((byte)*p)) {
+		parts[n++] = strtoul(p, (char**)&p, 10);
+		if (*p != ':' || n == 3)
+			break;
+		p++;
+	}
+	if (n < 2)
+		return false;
+	nSecs = parts[0] * 60 * 60 + parts[1] * 60 + ((n == 3) ? parts[2] : 0);
+	return true;
+}
+
+// from-to, where either can be left off
+static bool parsewindow(const char* p, options& opts)
+{
+	opts.bWindow = true;
+	opts.nFromSecs = 0;
+	opts.nToSecs = 0xffffffff;
+	if (*p != '-' && !parseclock(p, opts.nFromSecs))
+		return false;
+	if (*p++ != '-')
+		return false;
+	if (*p && !parseclock(p, opts.nToSecs))
+		return false;
+	return *p == 0 && opts.nFromSecs < opts.nToSecs;
+}
+
+// --columns takes fielddesc[] names separated by commas, any of them with L
+// or R in front for just that engine of a twin. On an unknown name, it's left
+// in bad.
+static bool parsecolumns(const char* p, options& opts, std::string& bad)
+{
+	opts.bColumns = true;
+	opts.columnmask[0] = opts.columnmask[1] = 0;
+	do {
+		size_t n = strcspn(p, ",");
+		bad.assign(p, n);
+		std::string name = bad;
+		for (size_t i = 0; i < name.size(); i++)
+			name[i] = (char)toupper((byte)name[i]);
+		p += n;
+
+		// RPM isn't the R engine's PM, so the whole name is looked for first
+		unsigned nEngines = 3;							// bits for the L (or only) and R engines
+		uint64_t mask = 0;
+		for (unsigned i = 0; i < countof(fielddesc); i++) {
+			if (name == fielddesc[i].szName)
+				mask |= (uint64_t)1 << i;
+		}
+		if (!mask && (name[0] == 'L' || name[0] == 'R')) {
+			nEngines = (name[0] == 'L') ? 1 : 2;
+			for (unsigned i = 0; i < countof(fielddesc); i++) {
+				if (fielddesc[i].bPerEngine && name.compare(1, std::string::npos, fielddesc[i].szName) == 0)
+					mask |= (uint64_t)1 << i;
+			}
+		}
+		if (!mask)
+			return false;
+		for (unsigned j = 0; j < 2; j++) {
+			if (nEngines & (1 << j))
+				opts.columnmask[j] |= mask;
+		}
+	} while (*p++ == ',');
+	return true;
+}
+
+// --where expressions are comparisons of a name with a number, put together
+// with &&, || and ! and parentheses:
+//
+//   or     := and { "||" and }
+//   and    := not { "&&" not }
+//   not    := "!" not | "(" or ")" | name op number | number op name
+//   op     := "<" | "<=" | ">" | ">=" | "==" | "=" | "!="
+//
+// The names are checked here, against fielddesc[], and only matched up with
+// a flight's columns when wherefilter::compile() gets it.
+struct whereparser {
+	const char* p;
+	whereexpr& expr;
+	std::string err;
+
+	whereparser(const char* text, whereexpr& e) : p(text), expr(e) {}
+
+	bool parse_or(unsigned& iNode);
+	bool parse_and(unsigned& iNode);
+	bool parse_not(unsigned& iNode);
+	bool parse_compare(unsigned& iNode);
+	void skipspace(void) { while (isspace((byte)*p)) p++; }
+
+private:
+	bool next(const char* szToken);
+	bool name(std::string& s);
+	bool number(double& value);
+	bool fail(const char* szWhy) { err = szWhy; return false; }
+	unsigned add(whereop op, unsigned a, unsigned b);
+};
+
+// Step past szToken if it's next
+bool whereparser::next(const char* szToken)
+{
+	skipspace();
+	size_t n = strlen(szToken);
+	if (strncmp(p, szToken, n) != 0)
+		return false;
+	p += n;
+	return true;
+}
+
+bool whereparser::name(std::string& s)
+{
+	skipspace();
+	if (!isalpha((byte)*p))
+		return false;
+	s.clear();
+	while (isalnum((byte)*p))
+		s += (char)toupper((byte)*p++);
+	return true;
+}
+
+bool whereparser::number(double& value)
+{
+	skipspace();
+	char* pEnd;
+	value = strtod(p, &pEnd);
+	if (pEnd == p)
+		return false;
+	p = pEnd;
+	return true;
+}
+
+unsigned whereparser::add(whereop op, unsigned a, unsigned b)
+{
+	wherenode node;
+	node.op = op;
+	node.a = a;
+	node.b = b;
+	node.value = 0;
+	expr.nodes.push_back(node);
+	return (unsigned)expr.nodes.size() - 1;
+}
+
+bool whereparser::parse_or(unsigned& iNode)
+{
+	if (!parse_and(iNode))
+		return false;
+	while (next("||")) {
+		unsigned iRight;
+		if (!parse_and(iRight))
+			return false;
+		iNode = add(WHERE_OR, iNode, iRight);
+	}
+	return true;
+}
+
+bool whereparser::parse_and(unsigned& iNode)
+{
+	if (!parse_not(iNode))
+		return false;
+	while (next("&&")) {
+		unsigned iRight;
+		if (!parse_not(iRight))
+			return false;
+		iNode = add(WHERE_AND, iNode, iRight);
+	}
+	return true;
+}
+
+bool whereparser::parse_not(unsigned& iNode)
+{
+	skipspace();
+	if (p[0] == '!' && p[1] != '=') {
+		p++;
+		if (!parse_not(iNode))
+			return false;
+		iNode = add(WHERE_NOT, iNode, 0);
+		return true;
+	}
+	if (next("(")) {
+		if (!parse_or(iNode))
+			return false;
+		return next(")") || fail("a ) is missing");
+	}
+	return parse_compare(iNode);
+}
+
+bool whereparser::parse_compare(unsigned& iNode)
+{
+	// The longer operators go first, so < isn't taken for the start of <=
+	static const struct { const char* szOp; whereop op; whereop flipped; } ops[] = {
+		{ "<=", WHERE_LE, WHERE_GE }, { ">=", WHERE_GE, WHERE_LE }, { "==", WHERE_EQ, WHERE_EQ },
+		{ "!=", WHERE_NE, WHERE_NE }, { "<", WHERE_LT, WHERE_GT }, { ">", WHERE_GT, WHERE_LT },
+		{ "=", WHERE_EQ, WHERE_EQ },
+	};
+	std::string field;
+	double value;
+	bool bNumberFirst = !name(field);
+	if (bNumberFirst && !number(value))
+		return fail("expected a column name or a number");
+
+	unsigned iOp = 0;
+	while (iOp < countof(ops) && !next(ops[iOp].szOp))
+		iOp++;
+	if (iOp == countof(ops))
+		return fail("expected a comparison (<, <=, >, >=, == or !=)");
+
+	if (bNumberFirst ? !name(field) : !number(value))
+		return fail(bNumberFirst ? "expected a column name" : "expected a number");
+
+	// A name is a column title or CHT, EGT or TIT, with an L or R in front
+	// only for the ones each engine of a twin has
+	bool bKnown = false;
+	for (unsigned i = 0; i < MARK_FIELD && !bKnown; i++) {
+		bKnown = wherefield(field.c_str(), fielddesc[i].szName) ||
+			(fielddesc[i].bPerEngine && (field[0] == 'L' || field[0] == 'R') && wherefield(field.c_str() + 1, fielddesc[i].szName));
+	}
+	if (!bKnown) {
+		err = "unknown column " + field;
+		return false;
+	}
+
+	iNode = add(bNumberFirst ? ops[iOp].flipped : ops[iOp].op, 0, 0);
+	expr.nodes[iNode].name = field;
+	expr.nodes[iNode].value = value;
+	return true;
+}
+
+// On an error, why is in err
+static bool parsewhere(const char* p, whereexpr& expr, std::string& err)
+{
+	whereparser parser(p, expr);
+	expr.nodes.clear();
+	if (!parser.parse_or(expr.root)) {
+		err = parser.err;
+		return false;
+	}
+	parser.skipspace();
+	if (*parser.p) {
+		err = std::string("unexpected ") + parser.p;
+		return false;
+	}
+	return true;
+}
+
+// A file to translate, along with the switches in effect for it
+struct job {
+	std::string filename;
+	options opts;
+};
+
 int main(int argc, char* argv[])
 {
 	int i;
+	std::vector<job> jobs;
 
 	if (argc < 2)
 		usage();
 
 	for (i = 1; i < argc; i++) {
 		// Note that switches only apply to files that follow them on the cmd line
-		if (argv[i][0] == '-' || argv[i][0] == '/') {
+		if (argv[i][0] == '-' && argv[i][1] == '-') {
+			// long options, --name value or --name=value
+			std::string name = argv[i] + 2;
+			const char* val = NULL;
+			size_t eq = name.find('=');
+			if (eq != std::string::npos) {
+				val = argv[i] + 2 + eq + 1;
+				name.resize(eq);
+			}
+			if (name == "format") {
+				if (!val && i + 1 < argc)
+					val = argv[++i];
+				if (val && strcmp(val, "csv") == 0)
+					s_opts.bArrow = false;
+				else if (val && strcmp(val, "arrow") == 0)
+					s_opts.bArrow = true;
+				else
+					errexit("--format must be followed by csv or arrow\n");
+			}
+			else if (name == "catalog")
+				s_opts.bCatalog = true;
+			else if (name == "summary")
+				s_opts.bSummary = true;
+			else if (name == "exceedances")
+				s_opts.bExceedances = true;
+			else if (name == "columns") {
+				if (!val && i + 1 < argc)
+					val = argv[++i];
+				std::string bad;
+				if (!val)
+					errexit("--columns must be followed by the columns to write, like E1,E2,FF\n");
+				if (!parsecolumns(val, s_opts, bad))
+					errexit("Unknown column \"%s\" for --columns\n", bad.c_str());
+			}
+			else if (name == "where") {
+				if (!val && i + 1 < argc)
+					val = argv[++i];
+				if (!val)
+					errexit("--where must be followed by the rows to keep, like \"CHT>400 || OIL<40\"\n");
+				std::shared_ptr<whereexpr> pWhere(new whereexpr);
+				std::string err;
+				if (!parsewhere(val, *pWhere, err))
+					errexit("--where %s: %s\n", val, err.c_str());
+				s_opts.pWhere = pWhere;
+			}
+			else if (name == "stats") {
+				if (val && strcmp(val, "json") != 0)
+					errexit("--stats can only be followed by =json\n");
+				s_opts.bStats = true;
+				s_opts.bStatsJson = (val != NULL);
+			}
+			else
+				errexit("Unknown switch %s\n", argv[i]);
+		}
+		else if ((argv[i][0] == '-' || argv[i][0] == '/') && argv[i][1]) {
 			switch (tolower(argv[i][1])) {
 			case '?': usage(); break;
 #ifdef DBGOPTS
-			case 'h': s_bDisplayHeaders = true; break;
-			case 'd': s_bDebugDetail = true; break;
-			case 'c': s_bCompareCSV = true; break;
-			case 'n': noflights = true; break;
+			case 'h': s_opts.bDisplayHeaders = true; break;
+			case 'd': s_opts.bDebugDetail = true; break;
+			case 'c': s_opts.bCompareCSV = true; break;
+			case 'n': s_opts.bNoFlights = true; break;
 #endif
-			case 's': s_bSuppressSuffix = true; break;
-			case 'r': s_bRecalcChecksums = true; break;
+			case 's': s_opts.bSuppressSuffix = true; break;
+			case 'r': s_opts.bRecalcChecksums = true; break;
+			case 'u': s_opts.bUTC = true; break;
 			case 'f':
 				if (argv[i][2])
-					s_nOnlyFlight = atoi(argv[i] + 2);
+					s_opts.nOnlyFlight = atoi(argv[i] + 2);
 				else
 					errexit("-f argument must have the flight# follow without space separating it.");
 				break;
+			case 't': {
+				const char* val = argv[i][2] ? argv[i] + 2 : (i + 1 < argc) ? argv[++i] : "";
+				if (!parsewindow(val, s_opts))
+					errexit("-t must be followed by the times to keep, like 1:00-1:30\n");
+				break;
+			}
+			case 'j':
+				if (argv[i][2])
+					s_nJobs = atoi(argv[i] + 2);
+				else if (i + 1 < argc && argv[i + 1][strspn(argv[i + 1], "0123456789")] == 0)
+					s_nJobs = atoi(argv[++i]);
+				else
+					s_nJobs = 0;
+				if (s_nJobs == 0)
+					s_nJobs = max(1u, std::thread::hardware_concurrency());
+				break;
 			default: errexit("Unknown switch %s\n", argv[i]);
 			}
 		}
+		else if (strcmp(argv[i], "-") == 0) {
+			job jb = { argv[i], s_opts };
+			jobs.push_back(jb);
+		}
 		else {
 			// wildcards work too
 			char** filelist = getfilelist(argv[i]);
 			for (int j = 0; filelist[j]; j++) {
-				reset_vars();
-				printf("%s\n", filelist[j]);
-				read_file(filelist[j]);
-				parse_headers();
-				if (s_bRecalcChecksums)
-					recompute_checksums();
-				else
-#ifdef DBGOPTS
-					if (!noflights)
-#endif
-						parse_data();
+				job jb = { filelist[j], s_opts };
+				jobs.push_back(jb);
 			}
 			freelist(filelist);
 		}
 	}
 
-	return 0;
-}
+	// Hand the files out to the workers, which split up the flights within each
+	// file too. Without -j everything happens right here, one file after
+	// another, with messages shown as they come.
+	s_pool.start(s_nJobs);
+
+	for (unsigned j = 0; j < jobs.size(); j++) {
+		if (jobs[j].opts.bCatalog) {
+			fputs(CATALOG_HEADING, stdout);
+			break;
+		}
+	}
+
+	// --stats totals, of the files it was given for
+	runstats totals;
+	std::mutex totalslock;
+	bool bStatsJson = false;
+	std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+	std::atomic<unsigned> nFailed(0);
+	taskgroup batch;
+	for (unsigned j = 0; j < jobs.size(); j++) {
+		if (jobs[j].opts.bStats)
+			bStatsJson = jobs[j].opts.bStatsJson;
+		s_pool.run(batch, [&jobs, &nFailed, &totals, &totalslock, j]() {
+			datfile f(jobs[j].opts, jobs[j].filename.c_str(), j, s_nJobs > 1);
+			f.translate();
+			if (f.bFailed)
+				nFailed++;
+			if (f.opts.bStats) {
+				std::lock_guard<std::mutex> held(totalslock);
+				totals.add(f.stats);
+			}
+		});
+	}
+	s_pool.wait(batch);
+	s_pool.stop();
+
+	if (totals.nFiles > 1) {
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - tStart;
+		totals.wallsecs = secs.count();				// the batch's, rather than the files' added up
+		msglog out(false);
+		totals.report(out, NULL, bStatsJson);
+	}
 
+	return (nFailed > 0) ? 1 : 0;
+}
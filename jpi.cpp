@@ -0,0 +1,1119 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "jpi.h"
+
+// The SSE versions of the decoding need SSSE3, which is looked for at run time
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define JPI_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SSSE3_FUNC
+#else
+#define SSSE3_FUNC __attribute__((target("ssse3")))
+#endif
+#endif
+
+
+//
+// Some general helper definitions and functions
+//
+
+#define countof(array) (sizeof(array)/sizeof(array[0]))
+
+// Helpers to swap byte order for big endian
+static inline ushort byteswap(ushort w) {
+	return (((w & 0xFF00) >> 8) |
+		((w & 0x00FF) << 8));
+}
+
+static inline ulong byteswap(ulong dw) {
+	return (((dw & 0xFF000000) >> 24) |
+		((dw & 0x00FF0000) >> 8) |
+		((dw & 0x0000FF00) << 8) |
+		((dw & 0x000000FF) << 24));
+}
+
+// Whether the SSE versions of things can be used
+#ifdef JPI_SIMD
+static bool cpu_has_ssse3(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+
+static const bool s_bSimd = cpu_has_ssse3();
+
+bool jpi_have_simd(void)
+{
+	return s_bSimd;
+}
+
+#else
+static const bool s_bSimd = false;
+
+bool jpi_have_simd(void)
+{
+	return s_bSimd;
+}
+
+#endif
+
+// For each value of a byte of flags, how many bits are set and which ones
+// they are (lowest first), so a record's values can be picked up without
+// testing every bit
+static const struct flagtable {
+	byte count[256];
+	byte bits[256][8];
+
+	flagtable() {
+		for (unsigned v = 0; v < 256; v++) {
+			count[v] = 0;
+			for (unsigned i = 0; i < 8; i++)
+				if (v & (1 << i))
+					bits[v][count[v]++] = (byte)i;
+		}
+	}
+} s_flagtable;
+
+
+const char* jpi_strerror(jpistatus st)
+{
+	switch (st) {
+	case JPI_OK:						return "No error";
+	case JPI_END:						return "End of flight";
+	case JPI_UNKNOWN_RECORD:		return "Unrecognized header record";
+	case JPI_ERR_HEADER_FORMAT:	return "Header record format error";
+	case JPI_ERR_HEADER_CHECKSUM:	return "Header checksum failed";
+	case JPI_ERR_HEADER_VALUES:	return "Not enough values in header record";
+	case JPI_ERR_HEADER_TOO_LONG:	return "Header record too long";
+	case JPI_ERR_TOO_MANY_FLIGHTS:	return "Too many flights in one file";
+	case JPI_ERR_HEADERS_END:		return "Unexpected end of .DAT file";
+	case JPI_ERR_NO_FLIGHT:			return "No such flight in the file";
+	case JPI_ERR_FLIGHT_TOO_SHORT:	return "Flight data length too short";
+	case JPI_ERR_DATA_ENDS:			return "Data ends unexpectedly";
+	case JPI_ERR_FLIGHT_CHECKSUM:	return "Flight header checksum failed";
+	case JPI_ERR_FLIGHT_NUMBER:	return "Flight numbers don't match, invalid file";
+	case JPI_ERR_RECORD_ENDS:		return "Unexpected end of data record";
+	case JPI_ERR_DATA_CHECKSUM:	return "Data checksum failed";
+	case JPI_ERR_KEYFRAME:			return "Keyframe doesn't fit the flight";
+	}
+	return "Unknown error";
+}
+
+
+static const struct {
+	ushort model;
+	ushort newversion;
+	const char* oldverstring;
+} newmodeltable[] = {
+	{760,140,"139"}, // EDM-760 has different versioning stream, correct "new" version is a guess
+	{0,300,"299"} // all other models what is known at this point
+};
+
+
+// DIF is calculated
+void datarec::calcstuff(ulong configflags, unsigned nEngines)
+{
+	// max twin engine is 6 cyls per engine (not checked, as a bad file
+	// mustn't bring down whatever is decoding it)
+	if (jpi_have_simd())
+		calcdif_simd(NUMCYLS(configflags), nEngines);
+	else
+		calcdif(NUMCYLS(configflags), nEngines);
+
+	if (HASRPM(configflags)) {
+		rpm += (rpm_highbyte << 8);
+		rpm_highbyte = 0;							// ??
+	}
+}
+
+
+// The spread between the hottest and coolest EGT of each engine
+void datarec::calcdif(unsigned nCyls, unsigned nEngines)
+{
+	for (unsigned j = 0; j < nEngines; j++) {
+		short emax = -1, emin = 0x7fff;
+		for (unsigned i = 0; i < nCyls; i++) {
+			// cyls 7,8 & 9 are stored in the regt field, so this hack lines 'em up
+			unsigned idx = (i < 6) ? (i + j * TWINJUMP) : (i - 6 + TWINJUMP);
+			if (!testbit(naflags, idx)) {
+				if (egt[idx] < emin) emin = egt[idx];
+				if (egt[idx] > emax) emax = egt[idx];
+			}
+		}
+		dif[j] = emax - emin;
+	}
+}
+
+
+size_t jpi_record_size(const byte* p, size_t nAvail)
+{
+	if (nAvail < 3)
+		return 3;
+
+	// decodeflags[2] and the repeat count, then a byte of flags for each set
+	// of values, each set of EGT scale values, and each set of sign bits
+	size_t nFlags = 3 + s_flagtable.count[p[0]] + s_flagtable.count[p[1] & 0x3f];
+	if (nAvail < nFlags)
+		return nFlags;
+
+	// then a byte for each value and scale value flagged
+	size_t nbytes = nFlags;
+	const byte* pFlags = p + 3;
+	for (unsigned i = 0; i < 8; i++)
+		if (p[0] & (1 << i))
+			nbytes += s_flagtable.count[*pFlags++];
+	return nbytes + 1;
+}
+
+
+// HACK ALERT - special case for the RPM value, which seems to have the "scale"
+// in the next data field, so we need to recognize it and account for it because
+// they don't make the scale's sign bit match. See the special case lines in
+// jpiflight::decode() that take care of this.
+static const unsigned RPM_FIELD_NUM = offsetof(datarec, rpm) / sizeof(short);
+
+
+//
+// Checksum the various data records
+//
+// NOTE: This is the only change between the "new" .DAT files
+// and the "old" .DAT files, i.e. they changed the XOR based
+// checksum to the SUM based checksum in firmware versions after 3.00.
+//
+
+static byte calc_new_checksum(const void* pBytes, size_t nbytes)
+{
+	assert(pBytes && nbytes > 0);
+	byte cksum = 0;
+	const byte* p = reinterpret_cast<const byte*>(pBytes);
+	while (nbytes-- > 0)
+		cksum += *p++;
+	cksum = -cksum;
+	return cksum;
+}
+
+static byte calc_old_checksum(const void* pBytes, size_t nbytes)
+{
+	assert(pBytes && nbytes > 0);
+	byte cksum = 0;
+	const byte* p = reinterpret_cast<const byte*>(pBytes);
+	while (nbytes-- > 0)
+		cksum ^= *p++;
+	return cksum;
+}
+
+jpichecksums jpi_checksums_bytewise(const void* pBytes, size_t nbytes)
+{
+	jpichecksums sums;
+	sums.xorsum = calc_old_checksum(pBytes, nbytes);
+	sums.negsum = calc_new_checksum(pBytes, nbytes);
+	return sums;
+}
+
+#ifdef JPI_SIMD
+// 16 bytes at a time: XOR them into one register, and add them up with
+// psadbw, which sums each half of the 16 bytes into a 64 bit lane
+SSSE3_FUNC static const byte* checksums_simd(const byte* p, size_t nChunks, byte& xorsum, byte& sum)
+{
+	__m128i x = _mm_setzero_si128();
+	__m128i total = _mm_setzero_si128();
+	for (; nChunks; nChunks--, p += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)p);
+		x = _mm_xor_si128(x, bytes);
+		total = _mm_add_epi64(total, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+	}
+	x = _mm_xor_si128(x, _mm_srli_si128(x, 8));
+	x = _mm_xor_si128(x, _mm_srli_si128(x, 4));
+	x = _mm_xor_si128(x, _mm_srli_si128(x, 2));
+	x = _mm_xor_si128(x, _mm_srli_si128(x, 1));
+	total = _mm_add_epi64(total, _mm_srli_si128(total, 8));
+	xorsum = (byte)_mm_cvtsi128_si32(x);
+	sum = (byte)_mm_cvtsi128_si32(total);
+	return p;
+}
+#endif
+
+jpichecksums jpi_checksums(const void* pBytes, size_t nbytes)
+{
+	assert(pBytes && nbytes > 0);
+	const byte* p = reinterpret_cast<const byte*>(pBytes);
+	byte xorsum = 0, sum = 0;
+
+#ifdef JPI_SIMD
+	if (s_bSimd && nbytes >= 16) {
+		p = checksums_simd(p, nbytes / 16, xorsum, sum);
+		nbytes %= 16;
+	}
+#endif
+	for (; nbytes; nbytes--, p++) {
+		xorsum ^= *p;
+		sum += *p;
+	}
+
+	jpichecksums sums;
+	sums.xorsum = xorsum;
+	sums.negsum = -sum;
+	return sums;
+}
+
+bool jpiheaders::test_data_checksum(const void* pBytes, size_t nbytes, byte bTestCheck) const {
+	// ignore the firmware version - just check both, which come out of the same pass
+	jpichecksums sums = jpi_checksums(pBytes, nbytes);
+	return (sums.negsum == bTestCheck || sums.xorsum == bTestCheck);
+}
+
+jpistatus jpiheaders::test_records(const byte* pTop, const byte* pEnd, const byte** ppBad) const
+{
+	const byte* p = pTop;
+	*ppBad = NULL;
+
+	// Same test as jpiflight::next() for the end of the records
+	while (p + 3 < pEnd) {
+		size_t nbytes = jpi_record_size(p, pEnd - p);
+		if (nbytes > (size_t)(pEnd - p)) {
+			*ppBad = p;
+			return JPI_ERR_RECORD_ENDS;
+		}
+		if (!test_data_checksum(p, nbytes - 1, p[nbytes - 1])) {
+			*ppBad = p;
+			return JPI_ERR_DATA_CHECKSUM;
+		}
+		p += nbytes;
+	}
+	return JPI_OK;
+}
+
+//
+// The text header records
+//
+
+jpiheaders::jpiheaders()
+{
+	tailnum[0] = 0;
+	memset(&limits, 0, sizeof(limits));
+	memset(&config, 0, sizeof(config));
+	memset(&fuel, 0, sizeof(fuel));
+	memset(&timestamp, 0, sizeof(timestamp));
+	headerend = 0;
+	memset(flightlist, 0, sizeof(flightlist));
+	nFlights = 0;
+	nDataOffset = 0;
+	NewVersion = 0;
+	szOldVer = NULL;
+	nConfigOffset = nConfigLength = 0;
+}
+
+// Find which firmware version is "new" for this model of instrument
+void jpiheaders::find_versions(void)
+{
+	NewVersion = newmodeltable[countof(newmodeltable) - 1].newversion;
+	szOldVer = newmodeltable[countof(newmodeltable) - 1].oldverstring;
+	for (int i = 0; i < countof(newmodeltable); i++) {
+		if (newmodeltable[i].model == config.model) {
+			NewVersion = newmodeltable[i].newversion;
+			szOldVer = newmodeltable[i].oldverstring;
+			break;
+		}
+	}
+	assert(NewVersion != 0 && szOldVer != NULL);
+}
+
+//
+// Header records look like $C,830,63,0,1552,310*6A - a $ and a letter, comma
+// separated numbers (or the tail number for $U) and a * with the XOR of the
+// bytes between the $ and the * in hex. They're lexed right out of the file's
+// bytes, in one pass and never looking past the end of the record.
+//
+static const size_t MAX_HEADER_LINE = 255;	// header records are short
+
+static int hexdigit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;											// lower case
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+// Check the checksum of the nLine bytes at line, and find the * before it
+static jpistatus test_header_checksum(const char* line, size_t nLine, const char** ppStar)
+{
+	assert(line && nLine > 0);
+	const char* p = line + 1;
+	const char* pEnd = line + nLine;
+	const char* pStar = NULL;
+	byte cs = 0;
+	byte csStar = 0;
+
+	// the checksum covers everything before the last *
+	for (; p < pEnd; p++) {
+		if (*p == '*') {
+			pStar = p;
+			csStar = cs;
+		}
+		cs ^= *p;
+	}
+	if (!pStar || pStar + 1 == pEnd || pEnd - (pStar + 1) > 4)
+		return JPI_ERR_HEADER_FORMAT;
+
+	unsigned testval = 0;
+	for (p = pStar + 1; p < pEnd; p++) {
+		int n = hexdigit(*p);
+		if (n < 0)
+			return JPI_ERR_HEADER_FORMAT;
+		testval = (testval << 4) | n;
+	}
+	if (testval != csStar)
+		return JPI_ERR_HEADER_CHECKSUM;
+	*ppStar = pStar;
+	return JPI_OK;
+}
+
+//
+// Helper to parse a list of short values, which is most
+// of the text header records. p is just past the $X, and pStar the end of the
+// values. Any values past count are ignored.
+//
+static jpistatus parseshorts(void* results, const char* p, const char* pStar, unsigned count)
+{
+	assert(results != NULL && count > 0);
+	assert(p <= pStar && *pStar == '*');
+	ushort* sresults = static_cast<ushort*>(results);
+	for (unsigned i = 0; i < count; i++) {
+		if (*p++ != ',')
+			return JPI_ERR_HEADER_VALUES;
+		while (*p == ' ')
+			p++;
+		// out of range values wrap around, as they did with sscanf("%hu")
+		bool bNeg = (*p == '-');
+		if (bNeg)
+			p++;
+		if (*p < '0' || *p > '9')
+			return JPI_ERR_HEADER_VALUES;
+		unsigned n = 0;
+		do
+			n = (n * 10 + (*p++ - '0')) & 0xffff;
+		while (*p >= '0' && *p <= '9');
+		while (*p == ' ')
+			p++;
+		if (*p != ',' && *p != '*')
+			return JPI_ERR_HEADER_VALUES;
+		sresults[i] = (ushort)(bNeg ? 0 - n : n);
+	}
+	return JPI_OK;
+}
+
+// Parse out the relevent bits of one header record
+jpistatus jpi_parse_header(jpiheaders& hdrs, const char* line, size_t nLine, size_t nOffset, bool* pbLast)
+{
+	const char* pStar;
+	jpistatus st;
+
+	*pbLast = false;
+	if (nLine > MAX_HEADER_LINE)
+		return JPI_ERR_HEADER_TOO_LONG;
+	if (nLine < 2 || *line != '$')
+		return JPI_ERR_HEADER_FORMAT;
+
+	// check the checksum, which also finds the end of the values
+	if ((st = test_header_checksum(line, nLine, &pStar)) != JPI_OK)
+		return st;
+
+	// the values come after the $X
+	const char* p = line + 2;
+	if (p > pStar)
+		return JPI_ERR_HEADER_FORMAT;
+
+	switch (line[1]) {
+	case 'U': { // tail number
+		if (p < pStar)
+			p++;											// skip past comma
+		unsigned i;
+		for (i = 0; i < sizeof(hdrs.tailnum) - 1 && p < pStar && *p != '*'; i++)
+			hdrs.tailnum[i] = *p++;
+		hdrs.tailnum[i] = 0;
+		return JPI_OK;
+	}
+	case 'A': // limits info
+		return parseshorts(&hdrs.limits, p, pStar, 8);
+	case 'F': // fuel flow config info
+		return parseshorts(&hdrs.fuel, p, pStar, 5);
+	case 'T': // timestamp info
+		return parseshorts(&hdrs.timestamp, p, pStar, 6);
+	case 'C': { // instrument configuration info
+		if ((st = parseshorts(&hdrs.config, p, pStar, 5)) != JPI_OK)
+			return st;
+
+		hdrs.find_versions();
+
+		// remember where it is, in case the file gets changed back to the older format
+		hdrs.nConfigOffset = nOffset;
+		hdrs.nConfigLength = nLine;
+		return JPI_OK;
+	}
+	case 'L': // end of headers, unknown meaning
+		*pbLast = true;
+		return parseshorts(&hdrs.headerend, p, pStar, 1);
+
+	case 'D': // flight info
+		if (hdrs.nFlights >= countof(hdrs.flightlist))
+			return JPI_ERR_TOO_MANY_FLIGHTS;
+		if ((st = parseshorts(&hdrs.flightlist[hdrs.nFlights], p, pStar, 2)) != JPI_OK)
+			return st;
+		hdrs.nFlights++;
+		return JPI_OK;
+	}
+	return JPI_UNKNOWN_RECORD;
+}
+
+jpistatus jpi_parse_headers(jpiheaders& hdrs, const void* pBytes, size_t nBytes)
+{
+	const byte* pFileBytes = (const byte*)pBytes;
+	const byte* pEnd = pFileBytes + nBytes;
+	const byte* pLine;
+	const byte* lf;
+
+	for (pLine = pFileBytes; pLine < pEnd && (lf = (const byte*)memchr(pLine, '\r', pEnd - pLine)); pLine = lf) {
+		if (lf + 1 >= pEnd)
+			break;
+
+		bool bLast;
+		jpistatus st = jpi_parse_header(hdrs, (const char*)pLine, lf - pLine, pLine - pFileBytes, &bLast);
+		if (st != JPI_OK && st != JPI_UNKNOWN_RECORD)
+			return st;
+
+		lf += 2;											// point to next record
+		if (bLast) {
+			hdrs.nDataOffset = lf - pFileBytes;
+			return JPI_OK;
+		}
+	}
+	return JPI_ERR_HEADERS_END;
+}
+
+// Where the data for flight iFlight is in the nBytes of the file at pBytes.
+// Each flight's data follows right after the previous one's.
+// HACK - make a copy of the $C line with the version set back
+bool jpiheaders::old_config_header(const void* pFileBytes, std::string& patched) const
+{
+	char line[256];
+	if (config.firmware_version < NewVersion || nConfigLength == 0 || nConfigLength >= sizeof(line))
+		return false;
+	memcpy(line, (const char*)pFileBytes + nConfigOffset, nConfigLength);
+	line[nConfigLength] = 0;
+
+	char* p = line + 1;
+	char* ver = strrchr(p, ',');
+	char* endp = strrchr(p, '*');
+	if (!ver++ || !endp) // basic error check
+		return false;
+	while (*ver == ' ') ver++; // skip spaces
+	if (endp - ver != 3) // basic error check
+		return false;
+
+	memcpy(ver, szOldVer, 3);
+	ver += 3;
+	byte cs = 0;
+	while (p < endp)
+		cs ^= *p++;
+	char buf[8];
+	sprintf(buf, "%02X", cs);
+	endp++;
+	*endp++ = buf[0];
+	*endp++ = buf[1];
+
+	patched.assign(line, nConfigLength);
+	return true;
+}
+
+jpistatus jpiheaders::flightoffset(unsigned iFlight, size_t nBytes, size_t* pnTop, size_t* pnEnd) const
+{
+	if (iFlight >= nFlights)
+		return JPI_ERR_NO_FLIGHT;
+
+	size_t nTop = nDataOffset;
+	for (unsigned i = 0; i < iFlight; i++)
+		nTop += flightlist[i].data_length * sizeof(ushort);
+	size_t nEnd = nTop + flightlist[iFlight].data_length * sizeof(ushort);
+	if (nEnd >= nBytes)
+		return JPI_ERR_DATA_ENDS;
+	if (nEnd - nTop < sizeof(flightheader))
+		return JPI_ERR_FLIGHT_TOO_SHORT;
+
+	*pnTop = nTop;
+	*pnEnd = nEnd;
+	return JPI_OK;
+}
+
+jpistatus jpiheaders::findflight(const void* pBytes, size_t nBytes, unsigned iFlight, const byte** ppTop, const byte** ppEnd) const
+{
+	size_t nTop, nEnd;
+	jpistatus st = flightoffset(iFlight, nBytes, &nTop, &nEnd);
+	if (st != JPI_OK)
+		return st;
+
+	*ppTop = (const byte*)pBytes + nTop;
+	*ppEnd = (const byte*)pBytes + nEnd;
+	return JPI_OK;
+}
+
+
+//
+// The data records of a flight
+//
+
+jpiflight::jpiflight(const jpiheaders& h, unsigned iFlight)
+	: pFirst(NULL), pNext(NULL), nNextBytes(0), pDataEnd(NULL), nRepeat(0), hdrs(h), info(h.flightlist[iFlight]), rec(h.numengine()),
+	pRecord(NULL), nRecordBytes(0), bNewValues(false), nRow(0), decoder(jpi_decode_generic)
+{
+	// Note that ctor will init datarec appropriately
+	memset(&fhead, 0, sizeof(fhead));
+}
+
+jpistatus jpiflight::begin(const void* pBytes, size_t nBytes)
+{
+	const byte* pTop;
+	const byte* pFlightEnd;
+	jpistatus st = hdrs.findflight(pBytes, nBytes, (unsigned)(&info - hdrs.flightlist), &pTop, &pFlightEnd);
+	if (st != JPI_OK)
+		return st;
+	return begin(pTop, pFlightEnd);
+}
+
+jpistatus jpiflight::begin(const byte* pTop, const byte* pFlightEnd)
+{
+	assert(pFlightEnd - pTop >= (ptrdiff_t)FLIGHTHEADER_SIZE);
+	pFirst = pNext = pTop + FLIGHTHEADER_SIZE;
+	nNextBytes = 0;
+	pDataEnd = pFlightEnd;
+	nRepeat = 0;
+	nRow = 0;
+	return read_header(pTop);
+}
+
+void jpiflight::keyframe(jpikeyframe& kf) const
+{
+	assert(at_record());
+	kf.nOffset = (uint32_t)(pNext - pFirst);
+	kf.nRow = (uint32_t)nRow;
+	kf.rec = rec;
+}
+
+jpistatus jpiflight::seek(const jpikeyframe& kf)
+{
+	if (kf.nOffset > (size_t)(pDataEnd - pFirst))
+		return JPI_ERR_KEYFRAME;
+	pNext = pFirst + kf.nOffset;
+	nNextBytes = 0;
+	nRepeat = 0;
+	nRow = kf.nRow;
+	rec = kf.rec;
+	return JPI_OK;
+}
+
+// A record's repeat count says how many rows of the values so far come before
+// its own row
+jpistatus jpiflight::next(void)
+{
+	if (nRepeat == 0 && nNextBytes == 0) {
+		// Will always read at least 3 bytes, and this ensures we don't go past
+		// the end in the event that the data record ends on an odd byte count.
+		// (Recall the length spec'd in the headers is given as # of 2 byte words.)
+		if (pNext + 3 >= pDataEnd)
+			return JPI_END;
+		nNextBytes = jpi_record_size(pNext, pDataEnd - pNext);
+		if (nNextBytes > (size_t)(pDataEnd - pNext)) {
+			pDataEnd = pNext;
+			return JPI_ERR_RECORD_ENDS;
+		}
+		nRepeat = jpi_repeat_count(pNext);
+	}
+	if (nRepeat) {
+		nRepeat--;
+		bNewValues = false;
+		nRow++;
+		return JPI_OK;
+	}
+
+	pRecord = pNext;
+	nRecordBytes = nNextBytes;
+	pNext += nNextBytes;
+	nNextBytes = 0;
+	bNewValues = true;
+	jpistatus st = decode(pRecord, nRecordBytes);
+	if (st != JPI_OK)
+		pDataEnd = pNext;									// nothing more after a bad record
+	else
+		nRow++;
+	return st;
+}
+
+// Parse the flight header (the FLIGHTHEADER_SIZE bytes at p) and sanity check it
+jpistatus jpiflight::read_header(const byte* p)
+{
+	const byte* pFlight = p;
+	ushort* usarray = reinterpret_cast<ushort*>(&fhead);
+	for (unsigned i = 0; i < FLIGHTHEADER_SHORTS; i++) {
+		usarray[i] = byteswap(*(ushort*)pFlight);
+		pFlight += sizeof(ushort);
+	}
+	if (!hdrs.test_data_checksum(&fhead, sizeof(flightheader), *pFlight++))
+		return JPI_ERR_FLIGHT_CHECKSUM;
+
+	// Sanity check the flight
+	if (fhead.flightnum != info.flightnum)
+		return JPI_ERR_FLIGHT_NUMBER;
+
+	// HACK ALERT UNTIL WE FIGURE OUT WHY THE SECONDS IS SOMETIMES ALL OUT OF WHACK!!
+	// There's probably a bit field somewhere that controls this (perhaps one of the
+	// bits in fhead.unknown_value?), but don't know which one yet. Given a few
+	// examples it's probably not too hard to track down.
+	if (fhead.interval_secs < 2 || 512 < fhead.interval_secs)
+		fhead.interval_secs = 6;
+
+	decoder = jpi_pick_decoder(fhead.flags, hdrs.numengine());
+	return JPI_OK;
+}
+
+// Pick up the flags at the front of a data record. The presence of one of
+// the bits of decodeflags indicates that at least one of the group of eight
+// fields of a "set" is present and that set's flags will be present.
+const byte* jpi_record_flags(const byte* pDataRec, byte* valflags, byte* scaleflags, byte* signflags)
+{
+	unsigned i;
+	const byte* pFlight = pDataRec;
+
+	// Get the first flags that flag which "sets" of data are there
+	// (the two always seem to be equal), and skip the repeat count
+	byte decodeflags[2];
+	decodeflags[0] = *pFlight++;
+	decodeflags[1] = *pFlight++;
+	pFlight++;
+
+	memset(valflags, 0, JPI_FLAG_BYTES);
+	memset(scaleflags, 0, JPI_SCALE_BYTES);
+	memset(signflags, 0, JPI_FLAG_BYTES);
+
+	for (i = 0; i < JPI_FLAG_BYTES; i++)
+		if (decodeflags[0] & (1 << i))
+			valflags[i] = *pFlight++;
+
+	// Check existence of the EGT scale value sets (the second has only
+	// been seen on twins)
+	for (i = 0; i < JPI_SCALE_BYTES; i++)
+		if (decodeflags[0] & (0x40 << i))
+			scaleflags[i] = *pFlight++;
+
+	// Get the sign bits
+	for (i = 0; i < JPI_FLAG_BYTES; i++)
+		if (decodeflags[1] & (1 << i))
+			signflags[i] = *pFlight++;
+
+	return pFlight;
+}
+
+// Values are stored as 8 bit difference from previous value (except EGTs
+// which could be a 16 bit difference from previous value). Sign
+// bit determines whether the difference value is added or subtracted.
+// For the EGT/TIT fields, scale bit determines whether the high
+// order byte of a two byte value is stored.
+//
+// Note that a difference flagged to exist but equal to zero is
+// the flag for "NA". This logic is not perfectly implemented below
+// but is hacked in to work for the most part. A little more effort
+// could refine the overall elegance a little.
+//
+// This one goes a byte of flags at a time: the flag table says how many
+// difference bytes the set has and which fields they go to, and the sign
+// bit of each is turned into a mask that negates the difference or not.
+const byte* jpi_apply_deltas(datarec& rec, const byte* valflags, const byte* scaleflags, const byte* signflags, const byte* p)
+{
+	unsigned i, n;
+
+	for (unsigned j = 0; j < JPI_FLAG_BYTES; j++) {
+		byte flags = valflags[j];
+		if (!flags)
+			continue;
+		const byte* bits = s_flagtable.bits[flags];
+		short* pValue = rec.sarray + j * 8;
+		byte signs = signflags[j];
+		byte na = 0;
+		for (i = 0, n = s_flagtable.count[flags]; i < n; i++) {
+			unsigned bit = bits[i];
+			short dif = p[i];
+			short neg = -(short)((signs >> bit) & 1);		// 0 or -1
+			pValue[bit] += (dif ^ neg) - neg;
+			na |= (byte)((dif == 0) << bit);
+		}
+		rec.naflags[j] = (rec.naflags[j] & ~flags) | na;
+		p += n;
+	}
+
+	for (unsigned j = 0; j < JPI_SCALE_BYTES; j++) {
+		byte flags = scaleflags[j];
+		if (!flags)
+			continue;
+		const byte* bits = s_flagtable.bits[flags];
+		short* pValue = rec.sarray + j * TWINJUMP;
+		byte signs = signflags[j * TWINJUMP / 8];
+		byte* pNA = rec.naflags + j * TWINJUMP / 8;
+		for (i = 0, n = s_flagtable.count[flags]; i < n; i++) {
+			unsigned bit = bits[i];
+			short x = (short)(p[i] << 8);
+			short neg = -(short)((signs >> bit) & 1);
+			pValue[bit] += (x ^ neg) - neg;
+			// a zero high byte leaves the NA flag the low byte gave it
+			if (x != 0)
+				*pNA &= ~(1 << bit);
+		}
+		p += n;
+	}
+	return p;
+}
+
+// The same thing a bit at a time, which is how the decoder used to do it,
+// kept to check the table driven one against
+const byte* jpi_apply_deltas_bitwise(datarec& rec, const byte* valflags, const byte* scaleflags, const byte* signflags, const byte* p)
+{
+	unsigned i;
+
+	for (i = 0; i < JPI_FLAG_BYTES * 8; i++) {
+		if (testbit(valflags, i)) {
+			if (*p == 0)
+				setbit(rec.naflags, i);
+			else
+				clearbit(rec.naflags, i);
+			if (testbit(signflags, i))
+				rec.sarray[i] -= *p++;
+			else
+				rec.sarray[i] += *p++;
+		}
+	}
+
+	for (unsigned j = 0; j < JPI_SCALE_BYTES; j++) {
+		for (i = 0; i < 8; i++) {
+			if (testbit(scaleflags + j, i)) {
+				unsigned idx = j * TWINJUMP + i;
+				ushort x = *p++;
+				if (x != 0) {
+					clearbit(rec.naflags, idx);
+					x <<= 8;
+					if (testbit(signflags, idx))
+						rec.sarray[idx] -= x;
+					else
+						rec.sarray[idx] += x;
+				}
+				// else... note that the low byte of the dif value
+				// would have set the naflags bit already if the
+				// high byte and low byte were both zero
+			}
+		}
+	}
+	return p;
+}
+
+//
+// The SSE versions work on a set of eight fields at a time, one in each
+// 16 bit lane of a register.
+//
+
+#ifdef JPI_SIMD
+
+// For each value of a byte of flags, the pshufb mask that moves the bytes
+// of the values it flags out to the 16 bit lanes of their fields
+static const struct expandtable {
+	byte lanes[256][16];
+
+	expandtable() {
+		for (unsigned v = 0; v < 256; v++) {
+			memset(lanes[v], 0x80, sizeof(lanes[v]));	// 0x80 = zero the byte
+			byte n = 0;
+			for (unsigned i = 0; i < 8; i++)
+				if (v & (1 << i))
+					lanes[v][2 * i] = n++;
+		}
+	}
+} s_expandtable;
+
+// All ones in the lanes whose bit is set in bits
+SSSE3_FUNC static inline __m128i lanemask(byte bits)
+{
+	const __m128i bitpos = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+	return _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16(bits), bitpos), bitpos);
+}
+
+// The other way around, a bit for each lane that's all ones
+SSSE3_FUNC static inline byte lanebits(__m128i mask)
+{
+	return (byte)_mm_movemask_epi8(_mm_packs_epi16(mask, _mm_setzero_si128()));
+}
+
+// The differences flagged by flags, from the bytes at p, in the lanes of their fields
+SSSE3_FUNC static inline __m128i expand(byte flags, const byte* p)
+{
+	return _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)p),
+		_mm_loadu_si128((const __m128i*)s_expandtable.lanes[flags]));
+}
+
+// Add the differences to the eight values at pValue, negating the ones with
+// their sign bit set
+SSSE3_FUNC static inline void adddifs(short* pValue, __m128i dif, byte signs)
+{
+	__m128i neg = lanemask(signs);
+	__m128i value = _mm_loadu_si128((const __m128i*)pValue);
+	value = _mm_add_epi16(value, _mm_sub_epi16(_mm_xor_si128(dif, neg), neg));
+	_mm_storeu_si128((__m128i*)pValue, value);
+}
+
+SSSE3_FUNC const byte* jpi_apply_deltas_simd(datarec& rec, const byte* valflags, const byte* scaleflags, const byte* signflags, const byte* p)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned j;
+
+	// The values are copied out first so the 8 byte loads can't go past the
+	// end of the record (or the file)
+	byte buf[(JPI_FLAG_BYTES + JPI_SCALE_BYTES) * 8 + 8];
+	size_t nbytes = 0;
+	for (j = 0; j < JPI_FLAG_BYTES; j++)
+		nbytes += s_flagtable.count[valflags[j]];
+	for (j = 0; j < JPI_SCALE_BYTES; j++)
+		nbytes += s_flagtable.count[scaleflags[j]];
+	memcpy(buf, p, nbytes);
+	const byte* pBuf = buf;
+
+	// A difference of zero is an NA
+	for (j = 0; j < JPI_FLAG_BYTES; j++) {
+		byte flags = valflags[j];
+		if (!flags)
+			continue;
+		__m128i dif = expand(flags, pBuf);
+		adddifs(rec.sarray + j * 8, dif, signflags[j]);
+		byte na = lanebits(_mm_cmpeq_epi16(dif, zero)) & flags;
+		rec.naflags[j] = (rec.naflags[j] & ~flags) | na;
+		pBuf += s_flagtable.count[flags];
+	}
+
+	// and an EGT with a high byte isn't
+	for (j = 0; j < JPI_SCALE_BYTES; j++) {
+		byte flags = scaleflags[j];
+		if (!flags)
+			continue;
+		__m128i dif = _mm_slli_epi16(expand(flags, pBuf), 8);
+		adddifs(rec.sarray + j * TWINJUMP, dif, signflags[j * TWINJUMP / 8]);
+		byte nonzero = ~lanebits(_mm_cmpeq_epi16(dif, zero)) & flags;
+		rec.naflags[j * TWINJUMP / 8] &= ~nonzero;
+		pBuf += s_flagtable.count[flags];
+	}
+	return p + nbytes;
+}
+
+// Take the first nCyls of the eight values at pValue that aren't NA into the
+// running min and max
+SSSE3_FUNC static inline void minmax(const short* pValue, byte naflags, unsigned nCyls, __m128i& emin, __m128i& emax)
+{
+	__m128i use = lanemask((byte)((1 << nCyls) - 1) & ~naflags);
+	__m128i value = _mm_loadu_si128((const __m128i*)pValue);
+	emin = _mm_min_epi16(emin, _mm_or_si128(_mm_and_si128(use, value), _mm_andnot_si128(use, _mm_set1_epi16(0x7fff))));
+	emax = _mm_max_epi16(emax, _mm_or_si128(_mm_and_si128(use, value), _mm_andnot_si128(use, _mm_set1_epi16(-1))));
+}
+
+// calcdif_simd(), inline for the decoding kernels below to have it with
+// nCyls and nEngines known
+SSSE3_FUNC static inline void calcdif_sse(datarec& rec, unsigned nCyls, unsigned nEngines)
+{
+	for (unsigned j = 0; j < nEngines; j++) {
+		__m128i emin = _mm_set1_epi16(0x7fff);
+		__m128i emax = _mm_set1_epi16(-1);
+		minmax(rec.egt + j * TWINJUMP, rec.naflags[j * TWINJUMP / 8], (nCyls < 6) ? nCyls : 6, emin, emax);
+		// cyls 7,8 & 9 are stored in the regt field
+		if (nCyls > 6)
+			minmax(rec.regt, rec.naflags[TWINJUMP / 8], nCyls - 6, emin, emax);
+
+		// and then across the lanes
+		emin = _mm_min_epi16(emin, _mm_shuffle_epi32(emin, _MM_SHUFFLE(1, 0, 3, 2)));
+		emin = _mm_min_epi16(emin, _mm_shuffle_epi32(emin, _MM_SHUFFLE(2, 3, 0, 1)));
+		emin = _mm_min_epi16(emin, _mm_shufflelo_epi16(emin, _MM_SHUFFLE(2, 3, 0, 1)));
+		emax = _mm_max_epi16(emax, _mm_shuffle_epi32(emax, _MM_SHUFFLE(1, 0, 3, 2)));
+		emax = _mm_max_epi16(emax, _mm_shuffle_epi32(emax, _MM_SHUFFLE(2, 3, 0, 1)));
+		emax = _mm_max_epi16(emax, _mm_shufflelo_epi16(emax, _MM_SHUFFLE(2, 3, 0, 1)));
+		rec.dif[j] = (short)_mm_cvtsi128_si32(emax) - (short)_mm_cvtsi128_si32(emin);
+	}
+}
+
+SSSE3_FUNC void datarec::calcdif_simd(unsigned nCyls, unsigned nEngines)
+{
+	calcdif_sse(*this, nCyls, nEngines);
+}
+
+#else // JPI_SIMD
+
+const byte* jpi_apply_deltas_simd(datarec& rec, const byte* valflags, const byte* scaleflags, const byte* signflags, const byte* p)
+{
+	return jpi_apply_deltas(rec, valflags, scaleflags, signflags, p);
+}
+
+void datarec::calcdif_simd(unsigned nCyls, unsigned nEngines)
+{
+	calcdif(nCyls, nEngines);
+}
+
+#endif // JPI_SIMD
+
+
+//
+// Decoding the values of a data record, for a particular layout
+//
+// Going from one record's values to the next is the same for every
+// instrument, but the DIF and the RPM high byte depend on how many engines
+// and cylinders there are and whether there's RPM. Rather than working those
+// out from the model and flags for every record, read_header() picks a
+// kernel made for the flight's layout, with the loops over the cylinders
+// unrolled and the SSE or plain versions of everything chosen already.
+// Layouts without one get jpi_decode_generic().
+//
+
+// HACK ALERT - special case the RPM high byte since it follows
+// the sign of the RPM field and doesn't appear to follow its
+// own sign bit. (Single engines only.)
+static inline void fix_rpm_highbyte(datarec& rec, const byte* signflags)
+{
+	if (testbit(signflags, RPM_FIELD_NUM))
+		rec.rpm_highbyte = -rec.rpm_highbyte;
+	if (rec.rpm_highbyte != 0)
+		clearbit(rec.naflags, RPM_FIELD_NUM);
+}
+
+const byte* jpi_decode_generic(datarec& rec, const byte* pDataRec, ulong configflags, unsigned nEngines)
+{
+	// Bit flags that indicate the existence of a given field
+	// in the compressed stream of difference values.
+	byte valflags[JPI_FLAG_BYTES];
+	byte scaleflags[JPI_SCALE_BYTES];			// flags presence of the EGT scale values
+	byte signflags[JPI_FLAG_BYTES];				// indicates sign of dif value
+
+	const byte* p = jpi_record_flags(pDataRec, valflags, scaleflags, signflags);
+	if (s_bSimd)
+		p = jpi_apply_deltas_simd(rec, valflags, scaleflags, signflags, p);
+	else
+		p = jpi_apply_deltas(rec, valflags, scaleflags, signflags, p);
+
+	if (nEngines == 1)
+		fix_rpm_highbyte(rec, signflags);
+
+	// Compute the DIF field
+	rec.calcstuff(configflags, nEngines);
+	return p;
+}
+
+// calcdif() for a layout
+template <unsigned nEngines, unsigned nCyls>
+static inline void calcdif_layout(datarec& rec)
+{
+	for (unsigned j = 0; j < nEngines; j++) {
+		short emax = -1, emin = 0x7fff;
+		for (unsigned i = 0; i < nCyls; i++) {
+			unsigned idx = (i < 6) ? (i + j * TWINJUMP) : (i - 6 + TWINJUMP);
+			if (!testbit(rec.naflags, idx)) {
+				if (rec.egt[idx] < emin) emin = rec.egt[idx];
+				if (rec.egt[idx] > emax) emax = rec.egt[idx];
+			}
+		}
+		rec.dif[j] = emax - emin;
+	}
+}
+
+template <unsigned nEngines, unsigned nCyls, bool bRPM>
+static const byte* decode_layout(datarec& rec, const byte* pDataRec, ulong, unsigned)
+{
+	byte valflags[JPI_FLAG_BYTES];
+	byte scaleflags[JPI_SCALE_BYTES];
+	byte signflags[JPI_FLAG_BYTES];
+
+	const byte* p = jpi_record_flags(pDataRec, valflags, scaleflags, signflags);
+	p = jpi_apply_deltas(rec, valflags, scaleflags, signflags, p);
+	if (nEngines == 1)
+		fix_rpm_highbyte(rec, signflags);
+	calcdif_layout<nEngines, nCyls>(rec);
+	if (bRPM) {
+		rec.rpm += (rec.rpm_highbyte << 8);
+		rec.rpm_highbyte = 0;
+	}
+	return p;
+}
+
+#ifdef JPI_SIMD
+template <unsigned nEngines, unsigned nCyls, bool bRPM>
+SSSE3_FUNC static const byte* decode_layout_simd(datarec& rec, const byte* pDataRec, ulong, unsigned)
+{
+	byte valflags[JPI_FLAG_BYTES];
+	byte scaleflags[JPI_SCALE_BYTES];
+	byte signflags[JPI_FLAG_BYTES];
+
+	const byte* p = jpi_record_flags(pDataRec, valflags, scaleflags, signflags);
+	p = jpi_apply_deltas_simd(rec, valflags, scaleflags, signflags, p);
+	if (nEngines == 1)
+		fix_rpm_highbyte(rec, signflags);
+	calcdif_sse(rec, nCyls, nEngines);
+	if (bRPM) {
+		rec.rpm += (rec.rpm_highbyte << 8);
+		rec.rpm_highbyte = 0;
+	}
+	return p;
+}
+#endif
+
+template <unsigned nEngines, unsigned nCyls>
+static jpi_decodefn layout_decoder(bool bRPM)
+{
+#ifdef JPI_SIMD
+	if (s_bSimd)
+		return bRPM ? decode_layout_simd<nEngines, nCyls, true> : decode_layout_simd<nEngines, nCyls, false>;
+#endif
+	return bRPM ? decode_layout<nEngines, nCyls, true> : decode_layout<nEngines, nCyls, false>;
+}
+
+jpi_decodefn jpi_pick_decoder(ulong configflags, unsigned nEngines)
+{
+	bool bRPM = HASRPM(configflags);
+	if (nEngines == 1) {
+		switch (NUMCYLS(configflags)) {
+		case 4: return layout_decoder<1, 4>(bRPM);
+		case 6: return layout_decoder<1, 6>(bRPM);
+		case 7: return layout_decoder<1, 7>(bRPM);
+		case 8: return layout_decoder<1, 8>(bRPM);
+		case 9: return layout_decoder<1, 9>(bRPM);
+		}
+	}
+	else if (nEngines == 2) {
+		switch (NUMCYLS(configflags)) {
+		case 4: return layout_decoder<2, 4>(bRPM);
+		case 6: return layout_decoder<2, 6>(bRPM);
+		}
+	}
+	return jpi_decode_generic;
+}
+
+// Decode the data record at pDataRec (nbytes long, as given by
+// jpi_record_size()) into rec. The repeat count is left to the caller.
+jpistatus jpiflight::decode(const byte* pDataRec, size_t nbytes)
+{
+	const byte* pFlight = decoder(rec, pDataRec, fhead.flags, hdrs.numengine());
+	assert(pFlight == pDataRec + nbytes - 1);
+	if (!hdrs.test_data_checksum(pDataRec, pFlight - pDataRec, *pFlight))
+		return JPI_ERR_DATA_CHECKSUM;
+	return JPI_OK;
+}
@@ -0,0 +1,548 @@
+//
+// libjpi - decoding the .DAT files downloaded from JPI EDM engine monitors
+//
+// The caller supplies the bytes, and nothing here does any I/O, prints
+// anything, or keeps any global state, so separate files (and the flights
+// of one file) can be decoded on as many threads as wanted. Problems with a
+// file come back as a jpistatus rather than ending the program. A whole file
+// in memory goes like this:
+//
+//		jpiheaders hdrs;
+//		jpistatus st = jpi_parse_headers(hdrs, pBytes, nBytes);
+//		for (unsigned i = 0; st == JPI_OK && i < hdrs.nFlights; i++) {
+//			jpiflight fl(hdrs, i);
+//			st = fl.begin(pBytes, nBytes);
+//			while (st == JPI_OK && (st = fl.next()) == JPI_OK)
+//				... fl.rec holds the values for the row ...
+//		}
+//		if (st != JPI_OK && st != JPI_END)
+//			... jpi_strerror(st) says what went wrong ...
+//
+// Rows come one at a time out of the file's bytes, with nothing allocated
+// along the way. For a file that arrives a piece at a time there are the
+// lower level jpi_parse_header(), jpiflight::read_header() and
+// jpiflight::decode(), which work on one record at a time.
+//
+
+#ifndef JPI_H
+#define JPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+
+typedef unsigned char byte;
+typedef unsigned short ushort;
+typedef unsigned long ulong;
+
+
+//
+// What went wrong, see jpi_strerror()
+//
+enum jpistatus {
+	JPI_OK = 0,
+	JPI_END,												// no more rows in the flight
+	JPI_UNKNOWN_RECORD,								// a header record that was skipped over
+	JPI_ERR_HEADER_FORMAT,
+	JPI_ERR_HEADER_CHECKSUM,
+	JPI_ERR_HEADER_VALUES,
+	JPI_ERR_HEADER_TOO_LONG,
+	JPI_ERR_TOO_MANY_FLIGHTS,
+	JPI_ERR_HEADERS_END,								// no $L record
+	JPI_ERR_NO_FLIGHT,
+	JPI_ERR_FLIGHT_TOO_SHORT,
+	JPI_ERR_DATA_ENDS,
+	JPI_ERR_FLIGHT_CHECKSUM,
+	JPI_ERR_FLIGHT_NUMBER,
+	JPI_ERR_RECORD_ENDS,
+	JPI_ERR_DATA_CHECKSUM,
+	JPI_ERR_KEYFRAME
+};
+
+const char* jpi_strerror(jpistatus st);
+
+
+// Generic bit vector manipulations, for datarec::naflags and the like
+static inline bool testbit(const void* pv, unsigned bitoffset)
+{
+	assert(pv != NULL);
+	assert(0 <= bitoffset && bitoffset < 128); // arbitrary limit for argument sanity checking
+	return ((((byte*)pv)[bitoffset / 8] & (1 << (bitoffset % 8))) != 0);
+}
+
+static inline void setbit(void* pv, unsigned bitoffset)
+{
+	assert(pv != NULL);
+	assert(0 <= bitoffset && bitoffset < 128); // arbitrary limit for argument sanity checking
+	((byte*)pv)[bitoffset / 8] |= (byte)(1 << (bitoffset % 8));
+}
+
+static inline void clearbit(void* pv, unsigned bitoffset)
+{
+	assert(pv != NULL);
+	assert(0 <= bitoffset && bitoffset < 128); // arbitrary limit for argument sanity checking
+	((byte*)pv)[bitoffset / 8] &= ~(byte)(1 << (bitoffset % 8));
+}
+
+
+//
+// Data definitions for various records used
+//
+
+#pragma pack(push)
+#pragma pack(1)
+
+
+// $A record
+struct limitsrec {
+	uint16_t voltshi;
+	uint16_t voltslo;
+	uint16_t dif;
+	uint16_t cht;
+	uint16_t cld;
+	uint16_t tit;
+	uint16_t oilhi;
+	uint16_t oillo;
+};
+
+// $C record
+struct configrec {
+	uint16_t model;
+	uint32_t flags;									// configuration bit flags
+	uint16_t unknown_value;							// maybe more bit flags?
+	uint16_t firmware_version;						// n.nn * 100
+};
+static_assert(sizeof(configrec) == 10, "$C has 5 values, one of them 32 bits");
+
+//Decoding of the configuration bit flagss:
+//-m-d fpai r2to eeee eeee eccc cccc cc-b
+//
+// e = egt (up to 9 cyls)
+// c = cht (up to 9 cyls)
+// d = probably cld
+// b = bat
+// o = oil
+// t = tit1
+// 2 = tit2
+// a = OAT
+// f = fuel flow
+// r = CDT (also CARB - apparently it's not distinguished in the CSV output)
+// i = IAT
+// m = MAP
+// p = RPM
+// *** e and c may be swapped
+// *** d and b may be swapped (but seem to always occur anyway)
+// *** m, p and i may be swapped among themselves
+
+static const int MAX_CYLS = 9;					  // up to 9 cyls possible
+
+static inline unsigned NUMCYLS(ulong flg) {
+	ulong mask = 0x00000004;
+	unsigned n = 0;
+	while (n < MAX_CYLS && (flg & mask)) {
+		n++;
+		mask <<= 1;
+	}
+	return n;
+}
+static inline unsigned NUMENGINE(ushort model) {
+	return (model == 760) ? 2 : 1;
+}
+static const ulong F_BAT = 0x00000001;
+static const ulong F_C1 = 0x00000004;
+static const ulong F_C2 = 0x00000008;
+static const ulong F_C3 = 0x00000010;
+static const ulong F_C4 = 0x00000020;
+static const ulong F_C5 = 0x00000040;
+static const ulong F_C6 = 0x00000080;
+static const ulong F_C7 = 0x00000100;
+static const ulong F_C8 = 0x00000200;
+static const ulong F_C9 = 0x00000400;
+static const ulong F_E1 = 0x00000800;
+static const ulong F_E2 = 0x00001000;
+static const ulong F_E3 = 0x00002000;
+static const ulong F_E4 = 0x00004000;
+static const ulong F_E5 = 0x00008000;
+static const ulong F_E6 = 0x00010000;
+static const ulong F_E7 = 0x00020000;
+static const ulong F_E8 = 0x00040000;
+static const ulong F_E9 = 0x00080000;
+static const ulong F_OIL = 0x00100000;
+static const ulong F_T1 = 0x00200000;
+static const ulong F_T2 = 0x00400000;
+static const ulong F_CDT = 0x00800000;			// also CRB
+static const ulong F_IAT = 0x01000000;
+static const ulong F_OAT = 0x02000000;
+static const ulong F_RPM = 0x04000000;
+static const ulong F_FF = 0x08000000;
+static const ulong F_USD = F_FF;					// duplicate
+static const ulong F_CLD = 0x10000000;			// Uh - I think.
+static const ulong F_MAP = 0x40000000;
+static const ulong F_DIF = F_E1 | F_E2;			// DIF exists if there's more than one EGT
+static const ulong F_HP = F_RPM | F_MAP | F_FF;
+static const ulong F_MARK = 0x00000001;			// 1 bit always seems to exist
+
+// quick way to define a bunch of funcs...
+#define HAS(what) static inline bool HAS##what(ulong flg) {return ((flg & F_##what) == F_##what);}
+HAS(RPM)
+HAS(FF)
+HAS(HP)
+
+// $F record
+struct fuelrec {
+	uint16_t warn1;
+	uint16_t capacity;
+	uint16_t warn2;
+	uint16_t kf1;
+	uint16_t kf2;
+};
+
+// $T record
+struct timestamprec {
+	uint16_t mon;
+	uint16_t day;
+	uint16_t yr;
+	uint16_t hh;
+	uint16_t mm;
+	uint16_t unknown_value;
+};
+
+// $D record
+struct flight {
+	uint16_t flightnum;
+	uint16_t data_length; // data length is expressed as # of 16 bit words
+};
+
+
+// First record in each flight's data stream
+struct flightheader {
+	uint16_t flightnum;
+	uint32_t flags;
+	uint16_t unknown_value;							// Don't know this one yet
+	uint16_t interval_secs;							// Hmmm... have seen some counter-examples!?
+	uint16_t dt;										// see decode_datebits
+	uint16_t tm;										// see decode_timebits
+};
+static const unsigned FLIGHTHEADER_SHORTS = 7;	// on disk
+static_assert(sizeof(flightheader) == FLIGHTHEADER_SHORTS * sizeof(uint16_t), "flight headers are 7 shorts on disk");
+static const size_t FLIGHTHEADER_SIZE = FLIGHTHEADER_SHORTS * sizeof(uint16_t) + 1;	// and its checksum
+
+// Each record of data stream
+union datarec {
+	short sarray[1];									// syntactical shorthand
+	struct {
+		// first byte of val/sign/scale flags
+		short egt[6];
+		short t1;
+		short t2;
+
+		// second byte of val/sign(/scale?) flags
+		short cht[6];
+		short cld;
+		short oil;
+
+		// third byte of val/sign(/scale?) flags
+		short mark;
+		short unk_3_1;
+		short cdt;
+		short iat;
+		short bat;
+		short oat;
+		short usd;
+		short ff;
+
+		// fourth byte of val/sign(/scale?) flags
+		short regt[6];									// NOTE: in 7/8/9 cyl case, E7-9 and C7-9 are stored here too
+		union {
+			short hp;									// single engine EDM-800
+			short rt1;									// twin engine EDM-760
+		};
+		short rt2;
+
+		// fifth byte of val/sign(/scale?) flags
+		short rcht[6];
+		short rcld;
+		short roil;
+
+		// sixth byte of val/sign(/scale?) flags
+		short map;										// single engine EDM-800
+		short rpm;										// single engine EDM-800
+		union {
+			short rpm_highbyte;						// single engine EDM-800
+			short rcdt;									// twin engine EDM-760
+		};
+		short riat;
+		short unk_6_4;
+		short unk_6_5;
+		short rusd;
+		short rff;
+
+		short dif[2];									// HACK - this gets computed
+		byte naflags[6];
+	};
+
+	datarec(unsigned nEngines) {
+		for (int i = 0; i < sizeof(*this) / sizeof(ushort); i++)
+			sarray[i] = 0x00f0;
+		if (nEngines == 1) {
+			// seen only one example of this... unclear why it's an exception to
+			// the 0xf0 initializations.
+			hp = 0;
+			rpm_highbyte = 0;							// really a "scale" byte
+		}
+
+		dif[0] = dif[1] = 0;
+		memset(naflags, 0, sizeof(naflags));
+	}
+
+	void calcstuff(ulong configflags, unsigned nEngines);
+
+	// The DIF part of calcstuff(), the plain way and with SSE (which only
+	// works if jpi_have_simd())
+	void calcdif(unsigned nCyls, unsigned nEngines);
+	void calcdif_simd(unsigned nCyls, unsigned nEngines);
+};
+
+static const unsigned TWINJUMP = offsetof(datarec, regt) / sizeof(short); // offset of 2nd engine egt fields
+
+#pragma pack(pop)
+
+
+//
+// The header records at the start of a .DAT file
+//
+struct jpiheaders {
+	char tailnum[16];									// $U - should be enough space
+	limitsrec limits;									// $A
+	configrec config;									// $C
+	fuelrec fuel;										// $F
+	timestamprec timestamp;							// $T
+	ushort headerend;									// $L
+	flight flightlist[512];							// $D - hopefully enough capacity for any single .DAT file
+	unsigned nFlights;
+	size_t nDataOffset;								// where the flights start, just past $L
+
+	// Set these when we determine which firmware version would apply
+	// (find_versions(), from config.model)
+	ushort NewVersion;								// firmware version that signifies new checksum
+	const char* szOldVer;
+
+	// Where the $C record is in the file (without its CR/LF)
+	size_t nConfigOffset;
+	size_t nConfigLength;
+
+	jpiheaders();
+
+	unsigned numengine(void) const { return NUMENGINE(config.model); }
+	void find_versions(void);
+	bool test_data_checksum(const void* pBytes, size_t nbytes, byte bTestCheck) const;
+
+	// Check the checksums of all the data records from pTop up to pEnd (a
+	// flight's, after its header) in one go. On an error, *ppBad is the
+	// record that has it.
+	jpistatus test_records(const byte* pTop, const byte* pEnd, const byte** ppBad) const;
+
+	// The $C record with its firmware version set back, for changing a file
+	// back to the older format that EZSave understands. Returns false if the
+	// file has an older version already, or the record can't be made sense of.
+	bool old_config_header(const void* pFileBytes, std::string& patched) const;
+	jpistatus findflight(const void* pBytes, size_t nBytes, unsigned iFlight, const byte** ppTop, const byte** ppEnd) const;
+
+	// Same as findflight(), as offsets into an nBytes file that needn't be in
+	// memory (the flight's header is at *pnTop)
+	jpistatus flightoffset(unsigned iFlight, size_t nBytes, size_t* pnTop, size_t* pnEnd) const;
+};
+
+// Parse the header records at the start of the nBytes at pBytes, up to and
+// including $L. Unrecognized records are skipped.
+jpistatus jpi_parse_headers(jpiheaders& hdrs, const void* pBytes, size_t nBytes);
+
+// Parse one header record, the nLine bytes of line (less its CR/LF) found at
+// nOffset in the file. *pbLast is set for the $L record, which is the last.
+// JPI_UNKNOWN_RECORD just means the record was ignored.
+jpistatus jpi_parse_header(jpiheaders& hdrs, const char* line, size_t nLine, size_t nOffset, bool* pbLast);
+
+// Size of the data record at p, checksum included, which can be told from
+// its flag bytes. If the nAvail bytes at p don't take in all of the flags,
+// this returns how many are needed to tell, which is more than nAvail.
+size_t jpi_record_size(const byte* p, size_t nAvail);
+
+// A data record starts with the number of rows that repeat the previous
+// record's values before its own row
+static inline unsigned jpi_repeat_count(const byte* pRecord) { return pRecord[2]; }
+
+// After that come the flags for which values it has (a byte for each set of
+// eight fields), for which EGTs have a high byte too, and for which values
+// are negative. jpi_record_flags() splits them out and returns where the
+// values themselves start.
+static const unsigned JPI_FLAG_BYTES = 6;
+static const unsigned JPI_SCALE_BYTES = 2;
+const byte* jpi_record_flags(const byte* pRecord, byte* valflags, byte* scaleflags, byte* signflags);
+
+// Apply the values at p, as flagged, to the previous record's values in rec,
+// returning the end of them. jpi_apply_deltas() is what jpiflight uses;
+// jpi_apply_deltas_bitwise() is the slower bit at a time version, kept to
+// check it against.
+typedef const byte* (*jpi_deltafn)(datarec& rec, const byte* valflags, const byte* scaleflags, const byte* signflags, const byte* p);
+const byte* jpi_apply_deltas(datarec& rec, const byte* valflags, const byte* scaleflags, const byte* signflags, const byte* p);
+const byte* jpi_apply_deltas_bitwise(datarec& rec, const byte* valflags, const byte* scaleflags, const byte* signflags, const byte* p);
+
+// On processors with SSSE3 (jpi_have_simd()), jpiflight uses this version of
+// jpi_apply_deltas() instead, and calcdif_simd() for the DIF
+bool jpi_have_simd(void);
+const byte* jpi_apply_deltas_simd(datarec& rec, const byte* valflags, const byte* scaleflags, const byte* signflags, const byte* p);
+
+// The flight headers and data records end with a checksum of their bytes,
+// which older firmware makes by XOR'ing them and newer by adding them up and
+// negating that. jpi_checksums() works out both in one pass; the bytewise
+// version is the two separate passes it replaced, kept to check it against.
+struct jpichecksums {
+	byte xorsum;										// older firmware
+	byte negsum;										// newer
+};
+jpichecksums jpi_checksums(const void* pBytes, size_t nbytes);
+jpichecksums jpi_checksums_bytewise(const void* pBytes, size_t nbytes);
+
+// Decode the data record at pDataRec into rec (the flags, the values and then
+// the DIF and RPM), returning where its checksum is. jpi_pick_decoder() gives
+// one made for the layout in the flight header's flags and the number of
+// engines, which jpiflight uses; jpi_decode_generic() works for any layout,
+// and is what's given for layouts there isn't one for.
+typedef const byte* (*jpi_decodefn)(datarec& rec, const byte* pDataRec, ulong configflags, unsigned nEngines);
+const byte* jpi_decode_generic(datarec& rec, const byte* pDataRec, ulong configflags, unsigned nEngines);
+jpi_decodefn jpi_pick_decoder(ulong configflags, unsigned nEngines);
+
+
+//
+// Decoding the data records of one flight. Each flight gets its own of
+// these, and they only share the (unchanging) headers.
+//
+// Where the decoding of a flight can be picked up again without going
+// through all the records before: the values as they were just before a
+// data record, where that record is (from the first one of the flight), and
+// how many rows came before it. These are saved in files as they are, so
+// they're the same size everywhere.
+struct jpikeyframe {
+	uint32_t nOffset;
+	uint32_t nRow;
+	datarec rec;
+
+	jpikeyframe() : nOffset(0), nRow(0), rec(1) {}
+};
+
+class jpiflight {
+	const byte* pFirst;								// first data record
+	const byte* pNext;								// record after pRecord...
+	size_t nNextBytes;								// ...and its size, once known
+	const byte* pDataEnd;
+	unsigned nRepeat;									// rows still to repeat rec
+
+public:
+	const jpiheaders& hdrs;
+	const flight& info;								// this flight's $D record
+	flightheader fhead;
+	datarec rec;										// values for the current row
+
+	// The last data record decoded, for a closer look when something is wrong
+	const byte* pRecord;
+	size_t nRecordBytes;
+	bool bNewValues;									// rec just came from pRecord, rather than repeating
+	ulong nRow;											// rows next() has given so far
+	jpi_decodefn decoder;							// picked by read_header() for the flight's layout
+
+	jpiflight(const jpiheaders& h, unsigned iFlight);
+
+	// The pull interface: begin() finds the flight in the nBytes of the file
+	// at pBytes (or is given where it is), and then each next() gives the
+	// next row in rec, or JPI_END after the last one.
+	jpistatus begin(const void* pBytes, size_t nBytes);
+	jpistatus begin(const byte* pTop, const byte* pFlightEnd);
+	jpistatus next(void);
+
+	// Between data records (at_record()), keyframe() can save where the
+	// decoding is, and after begin(), seek() can go straight to a keyframe
+	// taken before
+	bool at_record(void) const { return nRepeat == 0 && nNextBytes == 0; }
+	void keyframe(jpikeyframe& kf) const;
+	jpistatus seek(const jpikeyframe& kf);
+
+	// The pieces next() is made of, for bytes that arrive a piece at a time:
+	// read_header() gets the FLIGHTHEADER_SIZE bytes at p, and decode() the
+	// nbytes data record (see jpi_record_size()) at p into rec.
+	jpistatus read_header(const byte* p);
+	jpistatus decode(const byte* p, size_t nbytes);
+};
+
+
+//
+// Writing .DAT files, the other way from everything above. The files are
+// made up rather than from an instrument, for trying out and timing the
+// decoding, but they're written just as the instruments write them:
+//
+//		jpiwriter w;
+//		... fill in w.hdrs (tailnum, limits, config, fuel, timestamp, headerend)
+//		w.hdrs.find_versions();
+//		w.begin_flight(fhead);
+//		... w.record(rec, nRepeat) for each row that has new values ...
+//		w.end_flight();
+//		w.write(filebytes);
+//
+
+// The most a data record can take, and a flight ($D has its length in words)
+static const size_t JPI_MAX_RECORD_BYTES = 3 + 2 * JPI_FLAG_BYTES + JPI_SCALE_BYTES + JPI_FLAG_BYTES * 8 + JPI_SCALE_BYTES * 8 + 1;
+static const size_t JPI_MAX_FLIGHT_BYTES = 0xffff * sizeof(ushort);
+
+struct jpiwriter {
+	jpiheaders hdrs;									// for the header records, with $D filled in by end_flight()
+	std::vector<byte> data;							// the flights so far
+
+	jpiwriter();
+
+	// Start a flight with its flight header
+	void begin_flight(const flightheader& fhead);
+
+	// Add the data record that takes the values of the last one to those in
+	// rec, after nRepeat (up to 255) more rows of the last values. rec is as
+	// jpiflight gives it, with the naflags set for NA values (and the whole
+	// RPM in rpm); dif isn't written. Returns false if rec can't be got to
+	// from the last record: a difference too big for the field, or a field
+	// coming back from NA without a change.
+	bool record(const datarec& rec, unsigned nRepeat = 0);
+
+	// True if another record might take the flight over JPI_MAX_FLIGHT_BYTES
+	bool flight_full(void) const { return data.size() - nFlightTop + JPI_MAX_RECORD_BYTES > JPI_MAX_FLIGHT_BYTES; }
+	void end_flight(void);
+
+	// The whole file, header records and all
+	void write(std::vector<byte>& out) const;
+
+private:
+	size_t nFlightTop;								// where the flight being written starts in data
+	ushort nFlightNum;
+	datarec last;										// the values as the decoding will have them
+	bool bNewChecksums;
+
+	void checksum(size_t nFrom);
+};
+
+// What jpi_synth_file() makes up
+struct jpisynth {
+	ushort model;										// 760 is the twin
+	unsigned nCyls;									// for each engine
+	ulong extraflags;									// F_OIL, F_RPM and the like, beyond the cylinders
+	ushort firmware;									// n.nn * 100, which decides the checksums
+	unsigned nFlights;
+	ushort firstflight;								// the flight numbers go up from here
+	unsigned nRecords;								// data records in each flight (fewer if they won't fit)
+	unsigned seed;										// for the values, which are the same for the same seed
+};
+
+// Make up a .DAT file whose flights have values that wander around the way an
+// instrument's would, with NA values and repeated rows here and there.
+// Returns how many rows jpiflight will find in all of its flights.
+ulong jpi_synth_file(const jpisynth& synth, std::vector<byte>& out);
+
+#endif // JPI_H
@@ -0,0 +1,773 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+
+#include <vector>
+#include <chrono>
+
+#include "jpi.h"
+#include "jpiformat.h"
+
+//
+// JPIBench - how fast .DAT files can be gone through, on files made up by
+// jpi_synth_file() for a few kinds of instrument. Each phase is timed on its
+// own, and then all of them together:
+//
+//   checksum     the data record checksums, a flight at a time (test_records())
+//   sums         the same, a record at a time with jpi_checksums()...
+//   sums 2-pass  ...and with jpi_checksums_bytewise(), which it replaced
+//   values       the values in the data records, with jpi_apply_deltas()...
+//   values bits  ...with jpi_apply_deltas_bitwise(), which it replaced...
+//   values SSE   ...and with jpi_apply_deltas_simd(), when the CPU has SSSE3
+//   decode       the rows, with jpiflight
+//   generic      the same, with jpi_decode_generic() rather than the decoder
+//                made for the layout
+//   format       the decoded rows as CSV lines, with the jpiformat.h
+//                formatter JPITranslator writes them with
+//   end-to-end   the header records, decoding and formatting from the file bytes
+//
+// The rows are checked against what was made up, so this also shows that
+// jpiwriter and jpiflight agree, and the checksums and values have to come
+// out the same every way they're worked out (the SSE decoding is also run
+// against the plain one on a million random records). So does the CSV
+// formatting, against sprintf() on edge values. Before any of that, the .DAT files in
+// testdata, which didn't come from jpiwriter, are decoded and formatted and
+// checked against the CSV (and --summary) files JPITranslator wrote for them.
+//
+
+#define countof(array) (sizeof(array)/sizeof(array[0]))
+
+static const ulong ALL_EXTRAS = F_OIL | F_T1 | F_CDT | F_IAT | F_OAT | F_RPM | F_FF | F_CLD | F_MAP | F_BAT;
+
+static const struct {
+	const char* szName;
+	ushort model;
+	unsigned nCyls;
+	ulong extraflags;
+	ushort firmware;
+} s_layouts[] = {
+	{ "EDM-830, 6 cyls", 830, 6, ALL_EXTRAS, 310 },
+	{ "EDM-700, 4 cyls, old checksums", 700, 4, F_OIL | F_OAT | F_BAT | F_FF, 250 },
+	{ "EDM-760 twin, 6 cyls", 760, 6, F_OIL | F_OAT | F_BAT | F_FF | F_T1 | F_CLD, 150 },
+	{ "EDM-900, 9 cyls, old checksums", 900, 9, ALL_EXTRAS, 290 },
+};
+
+// Program arguments
+static unsigned s_nFlights = 4;					// -f
+static unsigned s_nRecords = 4000;				// -r
+static unsigned s_nPasses = 5;					// -p
+static unsigned s_nSeed = 1;						// -s
+static bool s_bWrite = false;						// -w
+static const char* s_szTestDir = "testdata";	// -d
+
+static void errexit(const char* msg, ...)
+{
+	assert(msg != NULL);
+	va_list args;
+	va_start(args, msg);
+	vprintf(msg, args);
+	exit(1);
+}
+
+// A data record, split up the way jpi_apply_deltas() and friends want it
+struct deltarec {
+	byte valflags[JPI_FLAG_BYTES];
+	byte scaleflags[JPI_SCALE_BYTES];
+	byte signflags[JPI_FLAG_BYTES];
+	const byte* pValues;
+	const byte* pRecord;
+	size_t nbytes;										// without the checksum
+};
+
+// A made up file and what's known about it
+struct benchfile {
+	std::vector<byte> bytes;
+	ulong nRows;										// what jpi_synth_file() says there should be
+	jpiheaders hdrs;
+	std::vector<datarec> rows;						// for timing the formatting alone...
+	std::vector<bool> newvalues;					// ...and which of them were decoded rather than repeated
+	std::vector<deltarec> recs;						// every data record, for the sums and values phases
+};
+
+
+//
+// CSV lines, as JPITranslator makes them
+//
+
+// Output goes to a buffer that's just started over when it fills
+struct outbuf {
+	char buf[64 * 1024];
+	size_t n;
+	size_t nTotal;
+
+	outbuf() : n(0), nTotal(0) {}
+	char* reserve(size_t nMax) {
+		if (n + nMax > sizeof(buf)) {
+			nTotal += n;
+			n = 0;
+		}
+		return buf + n;
+	}
+};
+
+// The columns of a flight, and the row that's put together with them
+struct rowformat {
+	column columns[MAX_COLUMNS];
+	unsigned nColumns;
+	char rowbuf[512];
+	bool bValuesCurrent;								// the values in rowbuf are for the row
+
+	rowformat(const jpiheaders& hdrs, ulong flags) : bValuesCurrent(false) {
+		nColumns = jpi_plancolumns(columns, hdrs.numengine(), flags, NULL);
+	}
+
+	// The row's values are only rendered when they're new, the way
+	// JPITranslator only does when a data record is decoded (the first rows
+	// of a flight can be repeats of the values it starts with)
+	const char* csvline(const datarec& rec, bool bNewValues, const char* time, size_t ntime) {
+		const char* line = jpi_csvline(rowbuf, sizeof(rowbuf), bNewValues || !bValuesCurrent, columns, nColumns, rec, time, ntime);
+		bValuesCurrent = true;
+		return line;
+	}
+};
+
+// A row, with the time into the flight for its TIME
+static void formatrow(outbuf& out, rowformat& fmt, const datarec& rec, bool bNewValues, ulong nSecs)
+{
+	char time[JPI_MAX_TIME_FIELD];
+	char* p = time;
+	*p++ = '"';
+	p = putint(p, (int)(nSecs / 3600));
+	*p++ = ':';
+	p = putint(p, (int)(nSecs / 60 % 60));
+	*p++ = ':';
+	p = putint(p, (int)(nSecs % 60));
+	*p++ = '"';
+	const char* line = fmt.csvline(rec, bNewValues, time, p - time);
+	size_t n = strlen(line);
+	memcpy(out.reserve(n), line, n);
+	out.n += n;
+}
+
+
+//
+// The phases, each going through the whole file once
+//
+
+static void checksum_pass(const benchfile& file)
+{
+	for (unsigned iFlight = 0; iFlight < file.hdrs.nFlights; iFlight++) {
+		const byte* pTop;
+		const byte* pEnd;
+		const byte* pBad;
+		if (file.hdrs.findflight(file.bytes.data(), file.bytes.size(), iFlight, &pTop, &pEnd) != JPI_OK ||
+			file.hdrs.test_records(pTop + FLIGHTHEADER_SIZE, pEnd, &pBad) != JPI_OK)
+			errexit("Flight %u doesn't check out\n", iFlight);
+	}
+}
+
+template <jpichecksums (*fn)(const void*, size_t)>
+static byte sums_pass(const benchfile& file)
+{
+	byte keep = 0;
+	for (size_t i = 0; i < file.recs.size(); i++) {
+		jpichecksums sums = fn(file.recs[i].pRecord, file.recs[i].nbytes);
+		keep ^= sums.xorsum ^ sums.negsum;
+	}
+	return keep;
+}
+
+template <jpi_deltafn fn>
+static short values_pass(const benchfile& file)
+{
+	datarec rec(file.hdrs.numengine());
+	for (size_t i = 0; i < file.recs.size(); i++) {
+		const deltarec& d = file.recs[i];
+		fn(rec, d.valflags, d.scaleflags, d.signflags, d.pValues);
+	}
+	return rec.sarray[0];
+}
+
+static ulong decode_flights(const benchfile& file, bool bGeneric)
+{
+	ulong nRows = 0;
+	for (unsigned iFlight = 0; iFlight < file.hdrs.nFlights; iFlight++) {
+		jpiflight fl(file.hdrs, iFlight);
+		jpistatus st = fl.begin(file.bytes.data(), file.bytes.size());
+		if (bGeneric)
+			fl.decoder = jpi_decode_generic;
+		while (st == JPI_OK && (st = fl.next()) == JPI_OK)
+			nRows++;
+		if (st != JPI_END)
+			errexit("Flight %u doesn't decode: %s\n", iFlight, jpi_strerror(st));
+	}
+	return nRows;
+}
+
+static ulong decode_pass(const benchfile& file)
+{
+	return decode_flights(file, false);
+}
+
+static ulong generic_pass(const benchfile& file)
+{
+	return decode_flights(file, true);
+}
+
+static size_t format_pass(const benchfile& file)
+{
+	outbuf out;
+	rowformat fmt(file.hdrs, file.hdrs.config.flags);
+	for (size_t i = 0; i < file.rows.size(); i++)
+		formatrow(out, fmt, file.rows[i], file.newvalues[i], (ulong)i * 6);
+	return out.nTotal + out.n;
+}
+
+static size_t endtoend_pass(const benchfile& file)
+{
+	jpiheaders hdrs;
+	jpistatus st = jpi_parse_headers(hdrs, file.bytes.data(), file.bytes.size());
+	if (st != JPI_OK)
+		errexit("Headers don't parse: %s\n", jpi_strerror(st));
+
+	outbuf out;
+	for (unsigned iFlight = 0; iFlight < hdrs.nFlights; iFlight++) {
+		jpiflight fl(hdrs, iFlight);
+		st = fl.begin(file.bytes.data(), file.bytes.size());
+		rowformat fmt(hdrs, fl.fhead.flags);
+		ulong nSecs = 0;
+		while (st == JPI_OK && (st = fl.next()) == JPI_OK) {
+			formatrow(out, fmt, fl.rec, fl.bNewValues, nSecs);
+			nSecs += fl.fhead.interval_secs;
+		}
+		if (st != JPI_END)
+			errexit("Flight %u doesn't decode: %s\n", iFlight, jpi_strerror(st));
+	}
+	return out.nTotal + out.n;
+}
+
+//
+// The different ways of working out the same thing, against each other
+//
+
+// The checksums of the records, and then of random runs of bytes of every
+// length up to a few hundred, have to come out the same both ways
+static bool checkchecksums(const std::vector<deltarec>& recs)
+{
+	for (size_t i = 0; i < recs.size(); i++) {
+		jpichecksums a = jpi_checksums(recs[i].pRecord, recs[i].nbytes);
+		jpichecksums b = jpi_checksums_bytewise(recs[i].pRecord, recs[i].nbytes);
+		if (a.xorsum != b.xorsum || a.negsum != b.negsum)
+			return false;
+	}
+
+	byte buf[512];
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = (byte)(i * 167 + (i >> 3));
+	for (size_t nbytes = 1; nbytes <= 300; nbytes++) {
+		for (size_t at = 0; at < 16; at++) {
+			jpichecksums a = jpi_checksums(buf + at, nbytes);
+			jpichecksums b = jpi_checksums_bytewise(buf + at, nbytes);
+			if (a.xorsum != b.xorsum || a.negsum != b.negsum)
+				return false;
+		}
+	}
+	return true;
+}
+
+// The values of the records, and the DIFs, have to come out the same every
+// way. Returns the number of the first record that doesn't, or 0.
+static unsigned checkvalues(const std::vector<deltarec>& recs, unsigned nCyls, unsigned nEngines)
+{
+	datarec rec(nEngines), ref(nEngines);
+	size_t i;
+	for (i = 0; i < recs.size(); i++) {
+		const deltarec& d = recs[i];
+		const byte* pEnd = jpi_apply_deltas(rec, d.valflags, d.scaleflags, d.signflags, d.pValues);
+		if (jpi_apply_deltas_bitwise(ref, d.valflags, d.scaleflags, d.signflags, d.pValues) != pEnd ||
+			memcmp(&rec, &ref, sizeof(rec)))
+			return (unsigned)i + 1;
+	}
+	if (!jpi_have_simd())
+		return 0;
+
+	rec = ref = datarec(nEngines);
+	for (i = 0; i < recs.size(); i++) {
+		const deltarec& d = recs[i];
+		const byte* pEnd = jpi_apply_deltas_simd(rec, d.valflags, d.scaleflags, d.signflags, d.pValues);
+		if (jpi_apply_deltas(ref, d.valflags, d.scaleflags, d.signflags, d.pValues) != pEnd)
+			return (unsigned)i + 1;
+		rec.calcdif_simd(nCyls, nEngines);
+		ref.calcdif(nCyls, nEngines);
+		if (memcmp(&rec, &ref, sizeof(rec)))
+			return (unsigned)i + 1;
+	}
+	return 0;
+}
+
+// Run the SSE decoding against the plain one on random records, including
+// ones no instrument would write, and return the number of the first one
+// that comes out different (or 0)
+static unsigned fuzzdeltas(unsigned nTries)
+{
+	unsigned long long x = 88172645463325252ull;		// xorshift64
+	byte buf[(JPI_FLAG_BYTES + JPI_SCALE_BYTES) * 8 + 8];
+	unsigned i;
+
+	for (unsigned n = 1; n <= nTries; n++) {
+		for (i = 0; i < sizeof(buf); i++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			buf[i] = (byte)x;
+		}
+		unsigned nEngines = 1 + (buf[0] & 1);
+		unsigned nCyls = buf[1] % (MAX_CYLS + 1);
+
+		// start from made up values, with some NA flags too
+		datarec rec(nEngines), ref(nEngines);
+		for (i = 0; i < countof(rec.naflags); i++)
+			rec.naflags[i] = ref.naflags[i] = buf[2 + i];
+		for (i = 0; i < JPI_FLAG_BYTES * 8; i++)
+			rec.sarray[i] = ref.sarray[i] = (short)(buf[i] * 37 + (n << 4));
+
+		// and about half the values and scale values present
+		deltarec d;
+		for (i = 0; i < JPI_FLAG_BYTES; i++) {
+			d.valflags[i] = buf[8 + i] & buf[20 + i];
+			d.signflags[i] = buf[14 + i];
+		}
+		for (i = 0; i < JPI_SCALE_BYTES; i++)
+			d.scaleflags[i] = buf[26 + i] & buf[28 + i] & buf[30 + i];
+		d.pValues = buf + (buf[32] % 8);
+		if (n % 16 == 0)
+			memset(buf + 40, 0, 8);						// plenty of NA's
+
+		const byte* pEnd = jpi_apply_deltas_simd(rec, d.valflags, d.scaleflags, d.signflags, d.pValues);
+		if (pEnd != jpi_apply_deltas(ref, d.valflags, d.scaleflags, d.signflags, d.pValues))
+			return n;
+		rec.calcdif_simd(nCyls, nEngines);
+		ref.calcdif(nCyls, nEngines);
+		if (memcmp(&rec, &ref, sizeof(rec)))
+			return n;
+	}
+	return 0;
+}
+
+
+// A value as the translator always wrote it, before it was put together by
+// hand - which is right for everything but negative tenths
+static void baselinevalue(char* buf, short s, unsigned nScale)
+{
+	buf += sprintf(buf, ",%d", s / nScale);
+	if (s % nScale)
+		sprintf(buf, ".%d", s % nScale);
+}
+
+// The hand formatter against the sprintf() calls it replaced, for every value
+// a short can be that they got right, and the negative tenths they didn't
+// against what they should be. Then whole rows against
+// jpi_formatvalues_printf(), on values no made up file has: 0, negatives and
+// the most and least a short can be, in every column of a single and a twin,
+// NA and not.
+static void checkformat(void)
+{
+	static const unsigned scales[] = { 1, 10 };
+	for (unsigned i = 0; i < countof(scales); i++) {
+		for (int n = SHRT_MIN; n <= SHRT_MAX; n++) {
+			if (n < 0 && scales[i] > 1)
+				continue;
+			char hand[16], ref[16];
+			hand[0] = ',';
+			*putscaled(hand + 1, n, scales[i]) = 0;
+			baselinevalue(ref, (short)n, scales[i]);
+			if (strcmp(hand, ref) != 0)
+				errexit("%d in %u'ths comes out as %s, not %s\n", n, scales[i], hand + 1, ref + 1);
+		}
+	}
+
+	static const struct {
+		short n;
+		const char* szTenths;
+	} tenths[] = {
+		{ -1, "-0.1" }, { -5, "-0.5" }, { -9, "-0.9" }, { -10, "-1" }, { -15, "-1.5" }, { -100, "-10" }, { -1234, "-123.4" },
+		{ -32767, "-3276.7" }, { -32768, "-3276.8" },
+	};
+	for (unsigned i = 0; i < countof(tenths); i++) {
+		char buf[16];
+		*putscaled(buf, tenths[i].n, 10) = 0;
+		if (strcmp(buf, tenths[i].szTenths) != 0)
+			errexit("%d tenths come out as %s, not %s\n", tenths[i].n, buf, tenths[i].szTenths);
+	}
+
+	static const short values[] = { 0, 1, -1, 5, -5, 9, -9, 10, -10, 15, -15, 99, -99, 100, -100, 1234, -1234, 32767, -32767, -32768 };
+	for (unsigned nEngines = 1; nEngines <= 2; nEngines++) {
+		column columns[MAX_COLUMNS];
+		unsigned nColumns = jpi_plancolumns(columns, nEngines, ~(ulong)0, NULL);
+		for (unsigned n = 0; n < 2 * countof(values); n++) {
+			datarec rec(nEngines);
+			for (unsigned i = 0; i < nColumns; i++) {
+				rec.sarray[columns[i].nOffset] = values[(n + i) % countof(values)];
+				if (n >= countof(values) && i % 3 == 0 && columns[i].nNABit != NO_NABIT)
+					setbit(rec.naflags, columns[i].nNABit);
+			}
+			rec.mark = n & 1;
+
+			char hand[512], ref[512];
+			jpi_formatvalues(hand, sizeof(hand), columns, nColumns, rec);
+			jpi_formatvalues_printf(ref, sizeof(ref), columns, nColumns, rec);
+			if (strcmp(hand, ref) != 0)
+				errexit("The CSV formatting doesn't match sprintf():\n%s%s", hand, ref);
+		}
+	}
+}
+
+
+//
+// The test files
+//
+// The .CSV files next to them are what the translator wrote before any of
+// the speeding up, byte for byte - except F00901.CSV, where it used to write
+// an OAT value for a flight without one under a heading that had none.
+//
+
+static const struct {
+	const char* szFile;
+	bool bSummary;										// there's also the SUMMARY.CSV that --summary wrote
+} s_testfiles[] = {
+	{ "EDM830.DAT", false },
+	{ "EDM760.DAT", false },
+	{ "NOOAT.DAT", true },							// the second flight has no OAT, which the $C record does
+};
+
+static void readfile(const char* path, std::vector<byte>& bytes)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f)
+		errexit("Unable to open %s (-d gives where the test files are)\n", path);
+	byte buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		bytes.insert(bytes.end(), buf, buf + n);
+	fclose(f);
+}
+
+// The least and most of each of the $C record's columns in a flight, as
+// --summary has them: "NA" for any the flight doesn't have, or that were
+// never anything else
+struct summarycheck {
+	rowformat config;
+	const rowformat& flight;
+	unsigned iInFlight[MAX_COLUMNS];				// the column in flight, or MAX_COLUMNS
+	short nMin[MAX_COLUMNS], nMax[MAX_COLUMNS];
+	bool bSeen[MAX_COLUMNS];
+
+	summarycheck(const jpiheaders& hdrs, const rowformat& fmt) : config(hdrs, hdrs.config.flags), flight(fmt) {
+		for (unsigned i = 0; i < config.nColumns; i++) {
+			iInFlight[i] = MAX_COLUMNS;
+			for (unsigned j = 0; j < flight.nColumns; j++) {
+				if (flight.columns[j].nOffset == config.columns[i].nOffset)
+					iInFlight[i] = j;
+			}
+			bSeen[i] = false;
+		}
+	}
+
+	void addrow(const datarec& rec) {
+		for (unsigned i = 0; i < config.nColumns; i++) {
+			const column& col = config.columns[i];
+			if (iInFlight[i] == MAX_COLUMNS || (col.nNABit != NO_NABIT && testbit(rec.naflags, col.nNABit)))
+				continue;
+			short s = rec.sarray[col.nOffset];
+			if (!bSeen[i] || s < nMin[i])
+				nMin[i] = s;
+			if (!bSeen[i] || s > nMax[i])
+				nMax[i] = s;
+			bSeen[i] = true;
+		}
+	}
+
+	// What the summary line should have from the MIN of the first column on
+	std::string expected(void) const {
+		std::string out;
+		for (unsigned i = 0; i < config.nColumns; i++) {
+			if (!bSeen[i]) {
+				out += ",\"NA\",\"NA\"";
+				continue;
+			}
+			out += scaled(nMin[i], config.columns[i].nScale);
+			out += scaled(nMax[i], config.columns[i].nScale);
+		}
+		return out;
+	}
+
+	static std::string scaled(int n, unsigned nScale) {
+		char buf[16];
+		unsigned u = abs(n);
+		if (u % nScale)
+			sprintf(buf, ",%s%u.%u", (n < 0) ? "-" : "", u / nScale, u % nScale);
+		else
+			sprintf(buf, ",%s%u", (n < 0) ? "-" : "", u / nScale);
+		return buf;
+	}
+};
+
+// The MIN and MAX fields of a summary line, leaving out the MEANs and the
+// fields about the whole flight before them
+static std::string minmaxfields(const char* line)
+{
+	static const unsigned FLIGHT_FIELDS = 11;		// FLIGHT to OIL OVER
+	std::string out;
+	unsigned iField = 0;
+	for (const char* p = line; *p && *p != '\n'; iField++) {
+		const char* pEnd = strpbrk(p, ",\n");
+		if (!pEnd)
+			pEnd = p + strlen(p);
+		if (iField >= FLIGHT_FIELDS && (iField - FLIGHT_FIELDS) % 3 != 2)
+			out += "," + std::string(p, pEnd);
+		p = (*pEnd == ',') ? pEnd + 1 : pEnd;
+	}
+	return out;
+}
+
+// Each flight's rows, as jpi_csvline() has them, against the rows of the
+// F<flight>.CSV file that JPITranslator -s wrote. The TIME field is the
+// translator's own, so only what comes after it is looked at. With
+// bSummary, the least and most of each column are also checked against the
+// flight's line of the <file>-SUMMARY.CSV that --summary wrote.
+static ulong checkfile(const char* szFile, bool bSummary)
+{
+	char path[260];
+	sprintf(path, "%s/%s", s_szTestDir, szFile);
+	std::vector<byte> bytes;
+	readfile(path, bytes);
+
+	FILE* fSummary = NULL;
+	char summaryline[4096];
+	if (bSummary) {
+		sprintf(path, "%s/%.*s-SUMMARY.CSV", s_szTestDir, (int)(strrchr(szFile, '.') - szFile), szFile);
+		if (!(fSummary = fopen(path, "r")) || !fgets(summaryline, sizeof(summaryline), fSummary))
+			errexit("Unable to read %s\n", path);
+		sprintf(path, "%s/%s", s_szTestDir, szFile);
+	}
+
+	jpiheaders hdrs;
+	jpistatus st = jpi_parse_headers(hdrs, bytes.data(), bytes.size());
+	if (st != JPI_OK)
+		errexit("%s: headers don't parse: %s\n", path, jpi_strerror(st));
+
+	ulong nRows = 0;
+	for (unsigned iFlight = 0; iFlight < hdrs.nFlights; iFlight++) {
+		jpiflight fl(hdrs, iFlight);
+		if ((st = fl.begin(bytes.data(), bytes.size())) != JPI_OK)
+			errexit("%s: flight %u doesn't decode: %s\n", path, iFlight, jpi_strerror(st));
+		sprintf(path, "%s/F%05u.CSV", s_szTestDir, (unsigned)fl.info.flightnum);
+		FILE* f = fopen(path, "r");
+		if (!f)
+			errexit("Unable to open %s\n", path);
+
+		// the field titles, after the lines about the flight
+		rowformat fmt(hdrs, fl.fhead.flags);
+		char line[1024];
+		while (fgets(line, sizeof(line), f) && strncmp(line, "\"TIME\"", 6) != 0)
+			;
+		std::string titles = "\"TIME\"";
+		for (unsigned i = 0; i < fmt.nColumns; i++)
+			titles += std::string(",\"") + fmt.columns[i].szEng + fmt.columns[i].szName + "\"";
+		if ((fielddesc[MARK_FIELD].nFeatureFlag & fl.fhead.flags) == fielddesc[MARK_FIELD].nFeatureFlag)
+			titles += ",\"MARK\"";
+		titles += ",\n";
+		if (titles != line)
+			errexit("%s: the columns are\n%sbut should be\n%s", path, titles.c_str(), line);
+
+		summarycheck summary(hdrs, fmt);
+		while ((st = fl.next()) == JPI_OK) {
+			if (!fgets(line, sizeof(line), f))
+				errexit("%s: there are more than %lu rows\n", path, (unsigned long)fl.nRow - 1);
+			const char* pValues = strchr(line, ',');
+			const char* csv = fmt.csvline(fl.rec, fl.bNewValues, "", 0);
+			if (!pValues || strcmp(csv, pValues) != 0)
+				errexit("%s: row %lu is\n%s\nbut should be\n%s", path, (unsigned long)fl.nRow, csv, line);
+			summary.addrow(fl.rec);
+			nRows++;
+		}
+		if (st != JPI_END)
+			errexit("%s: row %lu doesn't decode: %s\n", path, (unsigned long)fl.nRow, jpi_strerror(st));
+		if (fgets(line, sizeof(line), f))
+			errexit("%s: there are only %lu rows\n", path, (unsigned long)fl.nRow);
+		fclose(f);
+
+		if (fSummary) {
+			if (!fgets(summaryline, sizeof(summaryline), fSummary))
+				errexit("%s: the summary has no line for flight %u\n", szFile, (unsigned)fl.info.flightnum);
+			std::string want = summary.expected();
+			if (minmaxfields(summaryline) != want)
+				errexit("%s: the summary of flight %u is\n%sbut its MIN and MAX should be\n%s\n", szFile, (unsigned)fl.info.flightnum, summaryline, want.c_str());
+		}
+	}
+	if (fSummary)
+		fclose(fSummary);
+	return nRows;
+}
+
+static void checkfiles(void)
+{
+	ulong nRows = 0;
+	for (unsigned i = 0; i < countof(s_testfiles); i++)
+		nRows += checkfile(s_testfiles[i].szFile, s_testfiles[i].bSummary);
+	printf("%s: %lu rows of %u files match\n", s_szTestDir, (unsigned long)nRows, (unsigned)countof(s_testfiles));
+}
+
+
+// The best of s_nPasses, in seconds
+template <typename pass>
+static double timepass(pass fn, const benchfile& file)
+{
+	double best = 0;
+	for (unsigned n = 0; n < s_nPasses; n++) {
+		std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+		fn(file);
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - tStart;
+		if (n == 0 || secs.count() < best)
+			best = secs.count();
+	}
+	return best;
+}
+
+static void report(const char* szPhase, double secs, const benchfile& file)
+{
+	printf("  %-12s %8.1f MB/s %8.2fM rows/s\n", szPhase,
+		file.bytes.size() / secs / 1e6, file.nRows / secs / 1e6);
+}
+
+static void bench(unsigned iLayout)
+{
+	jpisynth synth;
+	synth.model = s_layouts[iLayout].model;
+	synth.nCyls = s_layouts[iLayout].nCyls;
+	synth.extraflags = s_layouts[iLayout].extraflags;
+	synth.firmware = s_layouts[iLayout].firmware;
+	synth.nFlights = s_nFlights;
+	synth.firstflight = (ushort)((iLayout + 1) * 100);
+	synth.nRecords = s_nRecords;
+	synth.seed = s_nSeed + iLayout;
+
+	benchfile file;
+	file.nRows = jpi_synth_file(synth, file.bytes);
+	if (s_bWrite) {
+		char szFile[32];
+		sprintf(szFile, "SYNTH%u.DAT", iLayout + 1);
+		FILE* f = fopen(szFile, "wb");
+		if (!f || fwrite(file.bytes.data(), 1, file.bytes.size(), f) != file.bytes.size())
+			errexit("Unable to write %s\n", szFile);
+		fclose(f);
+	}
+
+	// Go through it once to see that it all decodes, the same with the
+	// generic decoder as with the one for the layout, and to keep the rows
+	jpistatus st = jpi_parse_headers(file.hdrs, file.bytes.data(), file.bytes.size());
+	if (st != JPI_OK)
+		errexit("Headers don't parse: %s\n", jpi_strerror(st));
+	for (unsigned iFlight = 0; iFlight < file.hdrs.nFlights; iFlight++) {
+		jpiflight fl(file.hdrs, iFlight);
+		jpiflight generic(file.hdrs, iFlight);
+		st = fl.begin(file.bytes.data(), file.bytes.size());
+		generic.begin(file.bytes.data(), file.bytes.size());
+		generic.decoder = jpi_decode_generic;
+		while (st == JPI_OK && (st = fl.next()) == JPI_OK) {
+			if (generic.next() != JPI_OK || memcmp(&generic.rec, &fl.rec, sizeof(fl.rec)) != 0)
+				errexit("Flight %u row %lu decodes differently with the generic decoder\n", iFlight, (unsigned long)fl.nRow);
+			file.rows.push_back(fl.rec);
+			file.newvalues.push_back(fl.bNewValues || fl.nRow == 1);
+			if (fl.bNewValues) {
+				deltarec d;
+				d.pValues = jpi_record_flags(fl.pRecord, d.valflags, d.scaleflags, d.signflags);
+				d.pRecord = fl.pRecord;
+				d.nbytes = fl.nRecordBytes - 1;
+				file.recs.push_back(d);
+			}
+		}
+		if (st != JPI_END)
+			errexit("Flight %u doesn't decode: %s\n", iFlight, jpi_strerror(st));
+	}
+	if (file.rows.size() != file.nRows)
+		errexit("%u rows decoded, but %u were written\n", (unsigned)file.rows.size(), (unsigned)file.nRows);
+	if (!checkchecksums(file.recs))
+		errexit("The checksums don't come out the same both ways\n");
+	unsigned nBad = checkvalues(file.recs, synth.nCyls, file.hdrs.numengine());
+	if (nBad)
+		errexit("Data record %u decodes differently with the bit at a time or SSE decoding\n", nBad);
+
+	printf("%s: %u flights, %lu rows, %.2f MB\n", s_layouts[iLayout].szName,
+		file.hdrs.nFlights, (unsigned long)file.nRows, file.bytes.size() / 1e6);
+	report("checksum", timepass(checksum_pass, file), file);
+	report("sums", timepass(sums_pass<jpi_checksums>, file), file);
+	report("sums 2-pass", timepass(sums_pass<jpi_checksums_bytewise>, file), file);
+	report("values", timepass(values_pass<jpi_apply_deltas>, file), file);
+	report("values bits", timepass(values_pass<jpi_apply_deltas_bitwise>, file), file);
+	if (jpi_have_simd())
+		report("values SSE", timepass(values_pass<jpi_apply_deltas_simd>, file), file);
+	report("decode", timepass(decode_pass, file), file);
+	report("generic", timepass(generic_pass, file), file);
+	report("format", timepass(format_pass, file), file);
+	report("end-to-end", timepass(endtoend_pass, file), file);
+}
+
+static void usage(void)
+{
+	printf(
+		"JPIBENCH [-f#] [-r#] [-p#] [-s#] [-w] [-ddir]\n"
+		"\n"
+		"  Times the checksums, decoding and formatting of made up .DAT files for\n"
+		"  a few kinds of instrument, in MB and rows a second, after checking the\n"
+		"  test files, and that each way of working out the checksums and values\n"
+		"  comes up with the same ones.\n"
+		"\n"
+		"  -f#     Flights in each file (4)\n"
+		"  -r#     Data records in each flight (4000)\n"
+		"  -p#     Passes to take the best time of (5)\n"
+		"  -s#     Seed for the made up values (1)\n"
+		"  -w      Also write the files out, as SYNTHn.DAT, for trying JPITranslator on\n"
+		"  -ddir   Where the test files are (testdata)\n"
+	);
+	exit(0);
+}
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		if ((argv[i][0] != '-' && argv[i][0] != '/') || !argv[i][1])
+			errexit("Unknown argument %s\n", argv[i]);
+		unsigned n = (unsigned)atoi(argv[i] + 2);
+		switch (argv[i][1]) {
+		case '?': usage(); break;
+		case 'f': s_nFlights = n; break;
+		case 'r': s_nRecords = n; break;
+		case 'p': s_nPasses = (n > 0) ? n : 1; break;
+		case 's': s_nSeed = n; break;
+		case 'w': s_bWrite = true; break;
+		case 'd': s_szTestDir = argv[i] + 2; break;
+		default: errexit("Unknown switch %s\n", argv[i]);
+		}
+	}
+
+	checkformat();
+	checkfiles();
+	if (jpi_have_simd()) {
+		unsigned nBad = fuzzdeltas(1000000);
+		if (nBad)
+			errexit("SSE decoding differs on random record %u\n", nBad);
+		printf("SSE decoding, and 1000000 random records decode the same without it\n");
+	}
+	else
+		printf("Scalar decoding\n");
+	for (unsigned i = 0; i < countof(s_layouts); i++)
+		bench(i);
+	return 0;
+}
@@ -0,0 +1,134 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "jpiformat.h"
+
+//
+// The CSV rows - see jpiformat.h
+//
+
+unsigned jpi_plancolumns(column* columns, unsigned nEngines, ulong flags, const uint64_t* columnmask)
+{
+	unsigned nColumns = 0;
+	for (unsigned j = 0; j < nEngines; j++) {
+
+		// loop through each field except "MARK" (the last field)
+		for (unsigned i = 0; i < MARK_FIELD; i++) {
+			if (!fielddesc[i].bPerEngine && j < nEngines - 1)
+				continue;
+			if (fielddesc[i].nWhichEng && !(fielddesc[i].nWhichEng & (1 << j)))
+				continue;
+			// making the & logic equal the flags allows some of the combined flags to work (e.g. HP)
+			if ((fielddesc[i].nFeatureFlag & flags) != fielddesc[i].nFeatureFlag)
+				continue;
+			if (columnmask && !(columnmask[j] & ((uint64_t)1 << i)))
+				continue;
+
+			assert(nColumns < MAX_COLUMNS);
+			column& col = columns[nColumns++];
+			col.nScale = fielddesc[i].nScale;
+			col.szName = fielddesc[i].szName;
+			if (!fielddesc[i].bPerEngine || nEngines == 1)
+				col.szEng = "";
+			else if (j > 0)
+				col.szEng = "R";
+			else
+				col.szEng = "L";
+
+			// yet another special case hack to cover the computed DIF field
+			if (fielddesc[i].nOffset < 0) {
+				col.nOffset = DIF_OFFSET + j;
+				col.nNABit = NO_NABIT;
+			}
+			else {
+				col.nOffset = fielddesc[i].nOffset;
+				if (fielddesc[i].bPerEngine)
+					col.nOffset += j * TWINJUMP;
+				col.nNABit = col.nOffset;
+			}
+		}
+	}
+	return nColumns;
+}
+
+char* jpi_formatvalues(char* outbuf, size_t outsize, const column* columns, unsigned nColumns, const datarec& rec)
+{
+	assert(outbuf != NULL && outsize > 0);
+	char* p = outbuf;
+
+	for (unsigned i = 0; i < nColumns; i++) {
+		const column& col = columns[i];
+		if (col.nNABit != NO_NABIT && testbit(rec.naflags, col.nNABit))
+			p = PUTLIT(p, ",\"NA\"");
+		else {
+			short s = rec.sarray[col.nOffset];
+			*p++ = ',';
+			if (col.nScale == 1)
+				p = putint(p, s);
+			else
+				p = putscaled(p, s, col.nScale);
+		}
+	}
+
+	// "MARK" field special case since it's output as a string not a numeric value
+	if (rec.mark)
+		p = PUTLIT(p, ",\"S\"\n");
+	else
+		p = PUTLIT(p, ",\n");
+	*p = 0;
+
+	assert(p < outbuf + outsize);
+	return p;
+}
+
+char* jpi_formatvalues_printf(char* outbuf, size_t outsize, const column* columns, unsigned nColumns, const datarec& rec)
+{
+	assert(outbuf != NULL && outsize > 0);
+	size_t nout = 0;
+
+	for (unsigned i = 0; i < nColumns; i++) {
+		const column& col = columns[i];
+		if (col.nNABit != NO_NABIT && testbit(rec.naflags, col.nNABit))
+			nout += sprintf(outbuf + nout, ",\"NA\"");
+		else {
+			short s = rec.sarray[col.nOffset];
+			if (s >= 0 || col.nScale == 1) {
+				// as it's always been done
+				nout += sprintf(outbuf + nout, ",%d", s / col.nScale);
+				if (s % col.nScale)
+					nout += sprintf(outbuf + nout, ".%d", s % col.nScale);
+			}
+			else {
+				// ...except that a negative s was made unsigned by the
+				// unsigned nScale, which made a mess of negative tenths
+				unsigned u = -s;
+				nout += sprintf(outbuf + nout, ",-%u", u / col.nScale);
+				if (u % col.nScale)
+					nout += sprintf(outbuf + nout, ".%u", u % col.nScale);
+			}
+		}
+	}
+
+	// "MARK" field special case since it's output as a string not a numeric value
+	nout += sprintf(outbuf + nout, ",%s\n", rec.mark ? "\"S\"" : "");
+
+	assert(nout < outsize);
+	return outbuf + nout;
+}
+
+const char* jpi_csvline(char* rowbuf, size_t rowsize, bool bRender, const column* columns, unsigned nColumns, const datarec& rec, const char* time, size_t ntime)
+{
+	assert(rowsize > JPI_MAX_TIME_FIELD && ntime <= JPI_MAX_TIME_FIELD);
+	char* pValues = rowbuf + JPI_MAX_TIME_FIELD;
+	if (bRender)
+		jpi_formatvalues(pValues, rowsize - JPI_MAX_TIME_FIELD, columns, nColumns, rec);
+
+	char* line = pValues - ntime;
+	memcpy(line, time, ntime);
+	return line;
+}
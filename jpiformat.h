@@ -0,0 +1,187 @@
+//
+// libjpi - the CSV rows JPITranslator writes for the decoded data records
+//
+// A flight's columns are worked out once from its flight header flags with
+// jpi_plancolumns(), and then each row is a trip through that list:
+//
+//		column columns[MAX_COLUMNS];
+//		unsigned nColumns = jpi_plancolumns(columns, hdrs.numengine(), fl.fhead.flags, NULL);
+//		char rowbuf[512];
+//		bool bRendered = false;
+//		while (fl.next() == JPI_OK) {
+//			... put the row's TIME field in time[] ...
+//			const char* line = jpi_csvline(rowbuf, sizeof(rowbuf), fl.bNewValues || !bRendered, columns, nColumns, fl.rec, time, nTime);
+//			bRendered = true;
+//		}
+//
+// (A flight can start with rows that repeat the values it starts with, before
+// any data record is decoded.)
+//
+// This is where most of the time goes when translating, so the text is put
+// together by hand rather than with sprintf(); jpi_formatvalues_printf() is
+// the same thing done the easy way, with the sprintf() calls the translator
+// always used, to check it against. The one place the two differ from those
+// calls is negative tenths, which they used to get wrong.
+//
+
+#ifndef JPIFORMAT_H
+#define JPIFORMAT_H
+
+#include "jpi.h"
+
+//
+// This table is a description of the fields in data records, with offsets and
+// text headers and the like. Be sure to KEEP THE FIELDS SORTED IN ORDER OF
+// THE CSV FILE OUTPUT!!!
+
+// a shorthand macro to save typing in the table...
+#define FLG(name) #name,F_##name
+
+static const struct {
+	bool bPerEngine;									// true if a val is per engine, false if just one val (EDM-760)
+	int nOffset;										// offset of field in rec.sarray
+	unsigned nScale;									// some are scaled by 10, most are not
+	const char* szName;								// title of field in CSV file
+	ulong nFeatureFlag;
+	unsigned nWhichEng;								// bit flags to flag which engine the item should display for
+} fielddesc[] = {
+	{true , 0, 1,FLG(E1)},
+	{true , 1, 1,FLG(E2)},
+	{true , 2, 1,FLG(E3)},
+	{true , 3, 1,FLG(E4)},
+	{true , 4, 1,FLG(E5)},
+	{true , 5, 1,FLG(E6)},
+	{true , TWINJUMP + 0, 1,FLG(E7)},
+	{true , TWINJUMP + 1, 1,FLG(E8)},
+	{true , TWINJUMP + 2, 1,FLG(E9)},
+	{true , 8, 1,FLG(C1)},
+	{true , 9, 1,FLG(C2)},
+	{true ,10, 1,FLG(C3)},
+	{true ,11, 1,FLG(C4)},
+	{true ,12, 1,FLG(C5)},
+	{true ,13, 1,FLG(C6)},
+	{true , TWINJUMP + 3, 1,FLG(C7)},
+	{true , TWINJUMP + 4, 1,FLG(C8)},
+	{true , TWINJUMP + 5, 1,FLG(C9)},
+	{true , 6, 1,FLG(T1)},
+	{true , 7, 1,FLG(T2)},
+	{true ,15, 1,FLG(OIL)},
+	{true ,-1, 1,FLG(DIF)},
+	{true ,14, 1,FLG(CLD)},
+	{false,21, 1,FLG(OAT)},
+	{true ,18, 1,FLG(CDT)},			// not sure whether these are available in the twin model
+	{true ,19, 1,FLG(IAT)},
+	{false,20,10,FLG(BAT),0x01},	// battery comes before FF/USD in the single models...
+	{true ,23,10,FLG(FF)},
+	{true ,22,10,FLG(USD)},
+	{false,20,10,FLG(BAT),0x02},	// battery comes after FF/USD in the twin model... sigh
+	{false,41, 1,FLG(RPM)},			// these only are available in the single EDM models
+	{false,40,10,FLG(MAP)},
+	{false,30, 1,FLG(HP)},
+
+	{false,16, 1,FLG(MARK)}
+};
+
+#undef FLG
+
+static const unsigned NUM_FIELDS = sizeof(fielddesc) / sizeof(fielddesc[0]);
+static const unsigned MARK_FIELD = NUM_FIELDS - 1;	// "MARK" is always the last one
+
+
+// The CSV columns of a flight are worked out from fielddesc[] once its flight
+// header is read, so writing each row is just a trip through this list.
+// Every value, even the computed DIF, is found in rec.sarray.
+struct column {
+	ushort nOffset;									// value in rec.sarray
+	ushort nScale;
+	ushort nNABit;										// bit in rec.naflags, or NO_NABIT
+	const char* szEng;								// "L"/"R" title prefix for twin engines
+	const char* szName;
+};
+
+static const unsigned MAX_COLUMNS = 2 * NUM_FIELDS;
+static_assert(NUM_FIELDS <= 64, "column masks keep a bit for each of fielddesc[] in a uint64_t");
+static const ushort NO_NABIT = 0xffff;
+static const unsigned DIF_OFFSET = offsetof(datarec, dif) / sizeof(short);
+
+// The columns for a flight with the given flags, in the order they're
+// output, leaving out any not in columnmask (a uint64_t of fielddesc[] bits
+// for each engine) unless it's NULL. Returns how many there are.
+unsigned jpi_plancolumns(column* columns, unsigned nEngines, ulong flags, const uint64_t* columnmask);
+
+
+//
+// Putting text together by hand. Each writes at p and returns the end of
+// what it wrote.
+//
+
+// n in decimal
+static inline char* putint(char* p, int n)
+{
+	char digits[12];
+	char* d = digits + sizeof(digits);
+	unsigned u = n;
+	if (n < 0) {
+		*p++ = '-';
+		u = 0 - u;
+	}
+	do {
+		*--d = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	while (d < digits + sizeof(digits))
+		*p++ = *d++;
+	return p;
+}
+
+// Two digits, with a leading zero
+static inline char* put2(char* p, unsigned n)
+{
+	*p++ = '0' + n / 10 % 10;
+	*p++ = '0' + n % 10;
+	return p;
+}
+
+static inline char* putstr(char* p, const char* str, size_t len)
+{
+	memcpy(p, str, len);
+	return p + len;
+}
+#define PUTLIT(p, lit) putstr(p, lit, sizeof(lit) - 1)
+
+// n in nScale'ths (tenths, say), without a decimal point when it's whole
+static inline char* putscaled(char* p, int n, unsigned nScale)
+{
+	unsigned u = n;
+	if (n < 0) {
+		*p++ = '-';
+		u = 0 - u;
+	}
+	p = putint(p, u / nScale);
+	if (u % nScale) {
+		*p++ = '.';
+		p = putint(p, u % nScale);
+	}
+	return p;
+}
+
+
+//
+// The rows
+//
+
+// The values part of a row - a comma and value for each column, the MARK and
+// the newline - NUL terminated. Returns the end of it.
+char* jpi_formatvalues(char* outbuf, size_t outsize, const column* columns, unsigned nColumns, const datarec& rec);
+char* jpi_formatvalues_printf(char* outbuf, size_t outsize, const column* columns, unsigned nColumns, const datarec& rec);
+
+// The values part of a row only changes when a new data record is decoded,
+// and a record's repeat count can make for a lot of rows, so the values are
+// rendered into rowbuf once (when bRender), just past room for the longest
+// TIME field. Each row then only needs its time put in front of them. Returns
+// the whole line, which is somewhere in rowbuf.
+static const size_t JPI_MAX_TIME_FIELD = 32;
+
+const char* jpi_csvline(char* rowbuf, size_t rowsize, bool bRender, const column* columns, unsigned nColumns, const datarec& rec, const char* time, size_t ntime);
+
+#endif // JPIFORMAT_H
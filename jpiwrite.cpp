@@ -0,0 +1,393 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "jpi.h"
+
+//
+// Writing .DAT files - everything jpi.cpp reads, backwards
+//
+
+#define countof(array) (sizeof(array)/sizeof(array[0]))
+
+static const unsigned RPM_FIELD_NUM = offsetof(datarec, rpm) / sizeof(short);
+static const unsigned RPM_HIGHBYTE_FIELD_NUM = offsetof(datarec, rpm_highbyte) / sizeof(short);
+static const unsigned MARK_FIELD_NUM = offsetof(datarec, mark) / sizeof(short);
+
+// The file is big endian
+static void putshort(std::vector<byte>& out, ushort w)
+{
+	out.push_back((byte)(w >> 8));
+	out.push_back((byte)w);
+}
+
+// A header record, from its text up to the *
+static void putheader(std::vector<byte>& out, const char* rec)
+{
+	assert(rec[0] == '$');
+	byte cs = 0;
+	for (const char* p = rec + 1; *p; p++)
+		cs ^= *p;
+	char buf[8];
+	sprintf(buf, "*%02X\r\n", cs);
+	out.insert(out.end(), rec, rec + strlen(rec));
+	out.insert(out.end(), buf, buf + strlen(buf));
+}
+
+// The header records that are a list of short values
+static void putshorts(std::vector<byte>& out, char type, const void* values, unsigned count)
+{
+	const ushort* svalues = static_cast<const ushort*>(values);
+	char rec[128];
+	int n = sprintf(rec, "$%c", type);
+	for (unsigned i = 0; i < count; i++)
+		n += sprintf(rec + n, ",%u", svalues[i]);
+	putheader(out, rec);
+}
+
+jpiwriter::jpiwriter()
+	: nFlightTop(0), nFlightNum(0), last(1), bNewChecksums(false)
+{
+}
+
+// The checksum of the bytes from nFrom to the end of data
+void jpiwriter::checksum(size_t nFrom)
+{
+	jpichecksums sums = jpi_checksums(&data[nFrom], data.size() - nFrom);
+	data.push_back(bNewChecksums ? sums.negsum : sums.xorsum);
+}
+
+void jpiwriter::begin_flight(const flightheader& fhead)
+{
+	assert(hdrs.NewVersion != 0);					// see find_versions()
+	bNewChecksums = (hdrs.config.firmware_version >= hdrs.NewVersion);
+	nFlightTop = data.size();
+	nFlightNum = fhead.flightnum;
+
+	// Same as jpiflight::read_header() - a short at a time, byte swapped
+	const ushort* usarray = reinterpret_cast<const ushort*>(&fhead);
+	for (unsigned i = 0; i < FLIGHTHEADER_SHORTS; i++)
+		putshort(data, usarray[i]);
+	checksum(nFlightTop);
+
+	last = datarec(hdrs.numengine());
+}
+
+bool jpiwriter::record(const datarec& rec, unsigned nRepeat)
+{
+	assert(nRepeat <= 0xff);
+	bool bSingle = (hdrs.numengine() == 1);
+
+	byte valflags[JPI_FLAG_BYTES] = { 0 };
+	byte scaleflags[JPI_SCALE_BYTES] = { 0 };
+	byte signflags[JPI_FLAG_BYTES] = { 0 };
+	byte values[JPI_FLAG_BYTES * 8];
+	byte scales[JPI_SCALE_BYTES * 8];
+
+	for (unsigned i = 0; i < JPI_FLAG_BYTES * 8; i++) {
+		// the RPM high byte goes with the RPM
+		if (bSingle && i == RPM_HIGHBYTE_FIELD_NUM)
+			continue;
+
+		// An NA value is a difference of 0, and the value is kept for when
+		// it comes back, which takes a difference that isn't 0
+		bool bWasNA = testbit(last.naflags, i);
+		if (testbit(rec.naflags, i)) {
+			if (!bWasNA) {
+				setbit(valflags, i);
+				values[i] = 0;
+			}
+			continue;
+		}
+		short dif = (short)(rec.sarray[i] - last.sarray[i]);
+		if (dif == 0) {
+			if (bWasNA)
+				return false;
+			continue;
+		}
+		if (dif < 0)
+			setbit(signflags, i);
+		ushort n = (dif < 0) ? (ushort)-dif : (ushort)dif;
+
+		// The high bytes of the EGTs are scale values (the second set only on
+		// twins), and the RPM's is its own field (which follows the RPM's sign).
+		// A difference whose low byte is 0 is left to the high byte, as a 0 for
+		// the low byte would be NA.
+		unsigned j = i / TWINJUMP;
+		unsigned k = i % TWINJUMP;
+		if (bSingle && i == RPM_FIELD_NUM) {
+			if (n >> 8) {
+				setbit(valflags, RPM_HIGHBYTE_FIELD_NUM);
+				values[RPM_HIGHBYTE_FIELD_NUM] = (byte)(n >> 8);
+			}
+		}
+		else if (k < 8 && (j == 0 || (!bSingle && j < JPI_SCALE_BYTES))) {
+			if (n >> 8) {
+				setbit(scaleflags + j, k);
+				scales[j * 8 + k] = (byte)(n >> 8);
+			}
+		}
+		else if (n >> 8)
+			return false;
+		if (n & 0xff) {
+			setbit(valflags, i);
+			values[i] = (byte)n;
+		}
+	}
+
+	// The values are in as the decoding will have them
+	for (unsigned i = 0; i < JPI_FLAG_BYTES * 8; i++) {
+		if (bSingle && i == RPM_HIGHBYTE_FIELD_NUM)
+			continue;
+		if (testbit(rec.naflags, i))
+			setbit(last.naflags, i);
+		else {
+			clearbit(last.naflags, i);
+			last.sarray[i] = rec.sarray[i];
+		}
+	}
+
+	// See jpi_record_flags() for the layout
+	size_t nTop = data.size();
+	byte decodeflags = 0;
+	for (unsigned i = 0; i < JPI_FLAG_BYTES; i++)
+		if (valflags[i] || signflags[i])
+			decodeflags |= (byte)(1 << i);
+	for (unsigned i = 0; i < JPI_SCALE_BYTES; i++)
+		if (scaleflags[i])
+			decodeflags |= (byte)(0x40 << i);
+	data.push_back(decodeflags);
+	data.push_back(decodeflags);
+	data.push_back((byte)nRepeat);
+	for (unsigned i = 0; i < JPI_FLAG_BYTES; i++)
+		if (decodeflags & (1 << i))
+			data.push_back(valflags[i]);
+	for (unsigned i = 0; i < JPI_SCALE_BYTES; i++)
+		if (decodeflags & (0x40 << i))
+			data.push_back(scaleflags[i]);
+	for (unsigned i = 0; i < JPI_FLAG_BYTES; i++)
+		if (decodeflags & (1 << i))
+			data.push_back(signflags[i]);
+	for (unsigned i = 0; i < JPI_FLAG_BYTES * 8; i++)
+		if (testbit(valflags, i))
+			data.push_back(values[i]);
+	for (unsigned i = 0; i < JPI_SCALE_BYTES * 8; i++)
+		if (testbit(scaleflags, i))
+			data.push_back(scales[i]);
+	checksum(nTop);
+	return true;
+}
+
+void jpiwriter::end_flight(void)
+{
+	// $D has the length in words
+	if ((data.size() - nFlightTop) % 2)
+		data.push_back(0);
+	assert(data.size() - nFlightTop <= JPI_MAX_FLIGHT_BYTES);
+	assert(hdrs.nFlights < countof(hdrs.flightlist));
+	flight& info = hdrs.flightlist[hdrs.nFlights++];
+	info.flightnum = nFlightNum;
+	info.data_length = (ushort)((data.size() - nFlightTop) / sizeof(ushort));
+}
+
+void jpiwriter::write(std::vector<byte>& out) const
+{
+	char rec[64];
+	sprintf(rec, "$U,%.*s", (int)sizeof(hdrs.tailnum), hdrs.tailnum);
+	putheader(out, rec);
+	// the same counts of values that jpi_parse_header() reads
+	putshorts(out, 'A', &hdrs.limits, 8);
+	putshorts(out, 'F', &hdrs.fuel, 5);
+	putshorts(out, 'T', &hdrs.timestamp, 6);
+	putshorts(out, 'C', &hdrs.config, 5);
+	for (unsigned i = 0; i < hdrs.nFlights; i++)
+		putshorts(out, 'D', &hdrs.flightlist[i], 2);
+	putshorts(out, 'L', &hdrs.headerend, 1);
+	out.insert(out.end(), data.begin(), data.end());
+
+	// findflight() wants something after the last flight
+	putshort(out, 0);
+}
+
+
+//
+// Made up flights for jpi_synth_file()
+//
+
+// A small generator that comes out the same everywhere, unlike rand()
+struct synthrandom {
+	unsigned state;
+
+	synthrandom(unsigned seed) : state(seed ? seed : 1) {}
+	unsigned next(void) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	// from lo to hi, inclusive
+	int range(int lo, int hi) { return lo + (int)(next() % (unsigned)(hi - lo + 1)); }
+	bool chance(unsigned percent) { return next() % 100 < percent; }
+};
+
+// A field and how its values go. The EGTs, TITs and RPM wander the most, and
+// need the high bytes now and then.
+struct synthfield {
+	unsigned idx;
+	short base;											// values stay within spread of this
+	short spread;
+	short step;											// the most a value usually moves from row to row
+	bool bBig;											// has a high byte, so it can move more than 255
+};
+
+static unsigned synthfields(const jpiheaders& hdrs, synthfield* fields)
+{
+	ulong flags = hdrs.config.flags;
+	unsigned nEngines = hdrs.numengine();
+	unsigned nCyls = NUMCYLS(flags);
+	unsigned n = 0;
+
+	for (unsigned j = 0; j < nEngines; j++) {
+		unsigned jump = j * TWINJUMP;
+		for (unsigned i = 0; i < nCyls && i < 6; i++) {
+			synthfield egt = { i + jump, 1350, 150, 20, true };
+			synthfield cht = { 8 + i + jump, 350, 60, 5, false };
+			fields[n++] = egt;
+			fields[n++] = cht;
+		}
+		// cyls 7,8 & 9 are stored in the regt fields
+		for (unsigned i = 6; nEngines == 1 && i < nCyls; i++) {
+			synthfield egt = { TWINJUMP + i - 6, 1350, 150, 20, false };
+			synthfield cht = { TWINJUMP + i - 3, 350, 60, 5, false };
+			fields[n++] = egt;
+			fields[n++] = cht;
+		}
+		static const struct {
+			ulong flag;
+			synthfield field;
+		} engine[] = {
+			{ F_T1, { 6, 1400, 150, 20, true } },
+			{ F_T2, { 7, 1400, 150, 20, true } },
+			{ F_CLD, { 14, 20, 40, 5, false } },
+			{ F_OIL, { 15, 180, 30, 2, false } },
+			{ F_CDT, { 18, 100, 30, 3, false } },
+			{ F_IAT, { 19, 80, 20, 2, false } },
+			{ F_FF, { 23, 120, 40, 5, false } },
+		};
+		for (unsigned i = 0; i < countof(engine); i++) {
+			if (flags & engine[i].flag) {
+				fields[n] = engine[i].field;
+				fields[n++].idx += jump;
+			}
+		}
+	}
+
+	// The rest are only for the one (or the first) engine
+	static const synthfield bat = { 20, 140, 5, 1, false };
+	static const synthfield oat = { 21, 60, 30, 1, false };
+	static const synthfield mark = { MARK_FIELD_NUM, 0, 1, 1, false };
+	if (flags & F_BAT)
+		fields[n++] = bat;
+	if (flags & F_OAT)
+		fields[n++] = oat;
+	fields[n++] = mark;
+	if (nEngines == 1) {
+		static const synthfield map = { offsetof(datarec, map) / sizeof(short), 250, 40, 5, false };
+		static const synthfield rpm = { RPM_FIELD_NUM, 2400, 400, 50, true };
+		static const synthfield hp = { offsetof(datarec, hp) / sizeof(short), 65, 20, 2, false };
+		if (flags & F_MAP)
+			fields[n++] = map;
+		if (flags & F_RPM)
+			fields[n++] = rpm;
+		if (HASHP(flags))
+			fields[n++] = hp;
+	}
+	return n;
+}
+
+ulong jpi_synth_file(const jpisynth& synth, std::vector<byte>& out)
+{
+	jpiwriter w;
+	synthrandom rnd(synth.seed);
+
+	strcpy(w.hdrs.tailnum, "N12345");
+	static const limitsrec limits = { 305, 230, 500, 415, 60, 1650, 230, 90 };
+	static const fuelrec fuel = { 0, 49, 0, 2950, 2950 };
+	static const timestamprec timestamp = { 6, 15, 23, 10, 59, 4 };
+	w.hdrs.limits = limits;
+	w.hdrs.fuel = fuel;
+	w.hdrs.timestamp = timestamp;
+	w.hdrs.config.model = synth.model;
+	w.hdrs.config.flags = synth.extraflags;
+	for (unsigned i = 0; i < synth.nCyls && i < MAX_CYLS; i++)
+		w.hdrs.config.flags |= (F_C1 | F_E1) << i;
+	w.hdrs.config.unknown_value = 1552;
+	w.hdrs.config.firmware_version = synth.firmware;
+	w.hdrs.headerend = 49;
+	w.hdrs.find_versions();
+
+	synthfield fields[JPI_FLAG_BYTES * 8];
+	unsigned nFields = synthfields(w.hdrs, fields);
+	ulong nRows = 0;
+
+	for (unsigned iFlight = 0; iFlight < synth.nFlights && iFlight < countof(w.hdrs.flightlist); iFlight++) {
+		// a flight an hour, from the $T time
+		flightheader fhead;
+		fhead.flightnum = (ushort)(synth.firstflight + iFlight);
+		fhead.flags = w.hdrs.config.flags;
+		fhead.unknown_value = 0;
+		fhead.interval_secs = (iFlight % 3) ? 6 : 2;
+		fhead.dt = (ushort)(timestamp.day | (timestamp.mon << 5) | (timestamp.yr << 9));
+		fhead.tm = (ushort)((timestamp.mm << 5) | (((timestamp.hh + iFlight) % 24) << 11));
+		w.begin_flight(fhead);
+
+		// The values start from where the decoding does, and the ones without
+		// a high byte take a few records to get to where they belong
+		datarec rec(w.hdrs.numengine());
+		for (unsigned iRec = 0; iRec < synth.nRecords && !w.flight_full(); iRec++) {
+			unsigned nRepeat = (iRec && rnd.chance(30)) ? rnd.range(1, 12) : 0;
+			for (unsigned i = 0; i < nFields; i++) {
+				const synthfield& f = fields[i];
+				short& val = rec.sarray[f.idx];
+				int v;
+				if (val < f.base - f.spread || f.base + f.spread < val)
+					v = f.base;
+				else {
+					if (f.idx != MARK_FIELD_NUM && rnd.chance(1)) {
+						setbit(rec.naflags, f.idx);
+						continue;
+					}
+					bool bNA = testbit(rec.naflags, f.idx);
+					if (bNA && !rnd.chance(20))
+						continue;
+					if (!bNA && !rnd.chance(40))
+						continue;
+
+					// now and then a big jump, otherwise a step, but always a change
+					v = rnd.chance(2) ? rnd.range(f.base - f.spread, f.base + f.spread) : val + rnd.range(-f.step, f.step);
+					if (v < f.base - f.spread || f.base + f.spread < v)
+						v = 2 * val - v;
+					if (v == val)
+						v = (val < f.base) ? val + 1 : val - 1;
+				}
+				if (!f.bBig && v > val + 255)
+					v = val + 255;
+				else if (!f.bBig && v < val - 255)
+					v = val - 255;
+				clearbit(rec.naflags, f.idx);
+				val = (short)v;
+			}
+			bool bOK = w.record(rec, nRepeat);
+			assert(bOK);
+			(void)bOK;
+			nRows += 1 + nRepeat;
+		}
+		w.end_flight();
+	}
+	w.write(out);
+	return nRows;
+}